@@ -0,0 +1,245 @@
+/*
+ * File: cache.c
+ * Description:
+ *      A thread safe string to string hash table whose entries
+ *      expire after a TTL.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "cache.h"
+
+/* Desc:    Case insensitive djb2 hash of a string. */
+static unsigned long cache_hash(const char *key) {
+    unsigned long hash = 5381;
+    const unsigned char *p;
+
+    for(p = (const unsigned char *)key; *p != '\0'; p++)
+        hash = ((hash << 5) + hash) + tolower(*p);
+
+    return hash;
+}
+
+static void cache_entry_free(struct cache_entry *entry) {
+    free(entry->key);
+    free(entry->value);
+    free(entry);
+}
+
+/* Desc:    Removes every expired entry from a bucket.
+ *          The cache mutex must be held.
+ */
+static void cache_expire_bucket(cache *c, struct cache_entry **bucket,
+        time_t now) {
+    struct cache_entry *entry;
+
+    while(*bucket != NULL){
+        entry = *bucket;
+        if(entry->expires <= now){
+            *bucket = entry->next;
+            cache_entry_free(entry);
+            c->count--;
+        } else {
+            bucket = &entry->next;
+        }
+    }
+}
+
+/* Desc:    Removes every expired entry from the whole table, unless
+ *          that was already done this second.
+ *          The cache mutex must be held.
+ */
+static void cache_expire_all(cache *c, time_t now) {
+    int i;
+
+    if(c->swept == now)
+        return;
+    for(i = 0; i < c->nbuckets; i++)
+        cache_expire_bucket(c, &c->buckets[i], now);
+    c->swept = now;
+}
+
+/* Desc:    Doubles the number of buckets and moves every entry to
+ *          its new bucket. If there is no memory for the larger
+ *          table the old one is kept, which is only slower.
+ *          The cache mutex must be held.
+ */
+static void cache_grow(cache *c) {
+    struct cache_entry **buckets;
+    struct cache_entry *entry;
+    int nbuckets = c->nbuckets * 2;
+    int i;
+    unsigned long b;
+
+    buckets = calloc(nbuckets, sizeof(struct cache_entry *));
+    if(buckets == NULL)
+        return;
+    for(i = 0; i < c->nbuckets; i++){
+        while(c->buckets[i] != NULL){
+            entry = c->buckets[i];
+            c->buckets[i] = entry->next;
+            b = cache_hash(entry->key) % nbuckets;
+            entry->next = buckets[b];
+            buckets[b] = entry;
+        }
+    }
+    free(c->buckets);
+    c->buckets = buckets;
+    c->nbuckets = nbuckets;
+}
+
+/* Desc:    Adds a new entry to the front of a bucket.
+ *          The cache mutex must be held.
+ * Return:  CACHE_SUCCESS on success. CACHE_FAILURE on failure.
+ */
+static int cache_insert(cache *c, struct cache_entry **bucket,
+        const char *key, const char *value, time_t expires) {
+    struct cache_entry *entry;
+
+    entry = malloc(sizeof(struct cache_entry));
+    if(entry != NULL){
+        entry->key = strdup(key);
+        entry->value = strdup(value);
+    }
+    if(entry == NULL || entry->key == NULL || entry->value == NULL){
+        fprintf(stderr, "Error copying string to the heap.\n");
+        if(entry != NULL)
+            cache_entry_free(entry);
+        return CACHE_FAILURE;
+    }
+    entry->expires = expires;
+    entry->next = *bucket;
+    *bucket = entry;
+    c->count++;
+
+    return CACHE_SUCCESS;
+}
+
+int cache_init(cache *c, int nbuckets) {
+    int rc;
+
+    if(nbuckets < 1)
+        nbuckets = CACHE_BUCKETS;
+
+    c->buckets = calloc(nbuckets, sizeof(struct cache_entry *));
+    if(c->buckets == NULL){
+        fprintf(stderr, "Error mallocing.\n");
+        return CACHE_FAILURE;
+    }
+    c->nbuckets = nbuckets;
+    c->count = 0;
+    c->swept = 0;
+
+    rc = pthread_mutex_init(&c->mutex, NULL);
+    if(rc != 0){
+        fprintf(stderr, "There was an error initializing the mutex.\n");
+        free(c->buckets);
+        return CACHE_FAILURE;
+    }
+
+    return CACHE_SUCCESS;
+}
+
+int cache_get(cache *c, const char *key, char *value, int max_len) {
+    struct cache_entry **bucket;
+    struct cache_entry *entry;
+    int rc, ret = CACHE_MISS;
+
+    rc = pthread_mutex_lock(&c->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return CACHE_FAILURE;
+    }
+    /* The table may grow, so find the bucket under the lock */
+    bucket = &c->buckets[cache_hash(key) % c->nbuckets];
+    cache_expire_bucket(c, bucket, time(NULL));
+    for(entry = *bucket; entry != NULL; entry = entry->next){
+        if(strcasecmp(entry->key, key) == 0){
+            strncpy(value, entry->value, max_len);
+            value[max_len-1] = '\0';
+            ret = CACHE_SUCCESS;
+            break;
+        }
+    }
+    rc = pthread_mutex_unlock(&c->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+        return CACHE_FAILURE;
+    }
+
+    return ret;
+}
+
+int cache_put(cache *c, const char *key, const char *value,
+        unsigned long ttl) {
+    struct cache_entry **bucket;
+    struct cache_entry *entry;
+    char *value_copy;
+    time_t now = time(NULL);
+    int rc, ret = CACHE_SUCCESS;
+
+    rc = pthread_mutex_lock(&c->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return CACHE_FAILURE;
+    }
+    bucket = &c->buckets[cache_hash(key) % c->nbuckets];
+    cache_expire_bucket(c, bucket, now);
+
+    /* Replace the value if the key is already cached */
+    for(entry = *bucket; entry != NULL; entry = entry->next){
+        if(strcasecmp(entry->key, key) == 0)
+            break;
+    }
+    if(entry != NULL){
+        value_copy = strdup(value);
+        if(value_copy == NULL){
+            fprintf(stderr, "Error copying string to the heap.\n");
+            ret = CACHE_FAILURE;
+        } else {
+            free(entry->value);
+            entry->value = value_copy;
+            entry->expires = now + ttl;
+        }
+    } else {
+        /* A new entry. Make room by dropping what has expired
+         * before growing the table or giving up. */
+        if(c->count >= c->nbuckets || c->count >= CACHE_MAX_ENTRIES)
+            cache_expire_all(c, now);
+        if(c->count >= c->nbuckets && c->nbuckets < CACHE_MAX_BUCKETS){
+            cache_grow(c);
+            bucket = &c->buckets[cache_hash(key) % c->nbuckets];
+        }
+        if(c->count < CACHE_MAX_ENTRIES)
+            ret = cache_insert(c, bucket, key, value, now + ttl);
+    }
+
+    rc = pthread_mutex_unlock(&c->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+        return CACHE_FAILURE;
+    }
+
+    return ret;
+}
+
+void cache_cleanup(cache *c) {
+    struct cache_entry *entry;
+    int i;
+
+    for(i = 0; i < c->nbuckets; i++){
+        while(c->buckets[i] != NULL){
+            entry = c->buckets[i];
+            c->buckets[i] = entry->next;
+            cache_entry_free(entry);
+        }
+    }
+    free(c->buckets);
+    c->count = 0;
+    pthread_mutex_destroy(&c->mutex);
+}
@@ -0,0 +1,71 @@
+/*
+ * File: cache.h
+ * Description:
+ *      A thread safe string to string hash table whose entries
+ *      expire after a TTL. Used to cache DNS answers.
+ *
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <time.h>
+
+#define CACHE_FAILURE -1
+#define CACHE_SUCCESS 0
+#define CACHE_MISS 1
+
+#define CACHE_BUCKETS 4096              // Buckets a cache starts with.
+#define CACHE_MAX_ENTRIES 1000000
+#define CACHE_MAX_BUCKETS (1 << 20)     // Enough for CACHE_MAX_ENTRIES.
+
+struct cache_entry {
+    char *key;
+    char *value;
+    time_t expires;
+    struct cache_entry *next;
+};
+
+typedef struct cache_s {
+    struct cache_entry **buckets;
+    int nbuckets;
+    long count;
+    time_t swept;               // When expired entries were last purged.
+    pthread_mutex_t mutex;
+} cache;
+
+/* Desc:    Initializes an empty cache. The table doubles whenever
+ *          it holds more entries than buckets, up to
+ *          CACHE_MAX_BUCKETS, so chains stay short.
+ * Args:    c: the cache.
+ *          nbuckets: initial number of hash buckets. CACHE_BUCKETS
+ *          is used if this is less than 1.
+ * Return:  CACHE_SUCCESS on success. CACHE_FAILURE on failure.
+ */
+int cache_init(cache *c, int nbuckets);
+
+/* Desc:    Looks up key in the cache. Keys are compared
+ *          case insensitively. Expired entries are removed.
+ * Args:    value: buffer of size max_len that receives the
+ *          value if the key is found.
+ * Return:  CACHE_SUCCESS on a hit. CACHE_MISS on a miss.
+ *          CACHE_FAILURE on failure.
+ */
+int cache_get(cache *c, const char *key, char *value, int max_len);
+
+/* Desc:    Inserts or replaces key in the cache. The entry
+ *          expires after ttl seconds. Before the table grows or
+ *          fills up, expired entries are purged from all of it,
+ *          at most once a second, so the limit applies to live
+ *          entries. Nothing is stored once the cache holds
+ *          CACHE_MAX_ENTRIES live entries.
+ * Return:  CACHE_SUCCESS on success. CACHE_FAILURE on failure.
+ */
+int cache_put(cache *c, const char *key, const char *value,
+        unsigned long ttl);
+
+/* Desc:    Frees every entry and the cache's memory. */
+void cache_cleanup(cache *c);
+
+#endif
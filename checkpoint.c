@@ -0,0 +1,394 @@
+/*
+ * File: checkpoint.c
+ * Description:
+ *      Progress tracking so that an interrupted run can be
+ *      resumed without redoing finished lookups.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+static int pos_equal(struct input_pos a, struct input_pos b) {
+    return a.offset == b.offset && a.sub == b.sub;
+}
+
+static int pos_less(struct input_pos a, struct input_pos b) {
+    return a.offset < b.offset || (a.offset == b.offset && a.sub < b.sub);
+}
+
+/* Desc:    Adds a span to a file's spans written past the
+ *          watermark. The spans are kept sorted, and a span that
+ *          touches its neighbours is merged with them. Since the
+ *          spans of a file never overlap, this leaves one entry
+ *          per gap, so the list stays as short as the number of
+ *          results still in flight.
+ * Return:  CHECKPOINT_SUCCESS on success. CHECKPOINT_FAILURE on failure.
+ */
+static int progress_add(struct file_progress *p, const struct span *span) {
+    struct span *done;
+    int lo = 0, hi = p->ndone, mid, before, after, cap;
+
+    /* Find the first span that starts after this one */
+    while(lo < hi){
+        mid = lo + (hi - lo) / 2;
+        if(pos_less(p->done[mid].start, span->start))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    before = lo > 0 && pos_equal(p->done[lo-1].end, span->start);
+    after = lo < p->ndone && pos_equal(p->done[lo].start, span->end);
+    if(before && after){
+        p->done[lo-1].end = p->done[lo].end;
+        memmove(p->done + lo, p->done + lo + 1,
+                sizeof(struct span) * (p->ndone - lo - 1));
+        p->ndone--;
+        return CHECKPOINT_SUCCESS;
+    }
+    if(before){
+        p->done[lo-1].end = span->end;
+        return CHECKPOINT_SUCCESS;
+    }
+    if(after){
+        p->done[lo].start = span->start;
+        return CHECKPOINT_SUCCESS;
+    }
+
+    if(p->ndone == p->cap){
+        cap = p->cap ? p->cap * 2 : 16;
+        done = realloc(p->done, sizeof(struct span) * cap);
+        if(done == NULL){
+            fprintf(stderr, "Error mallocing.\n");
+            return CHECKPOINT_FAILURE;
+        }
+        p->done = done;
+        p->cap = cap;
+    }
+    memmove(p->done + lo + 1, p->done + lo,
+            sizeof(struct span) * (p->ndone - lo));
+    p->done[lo] = *span;
+    p->ndone++;
+
+    return CHECKPOINT_SUCCESS;
+}
+
+int checkpoint_init(struct checkpoint *ck, int nfiles) {
+    ck->fp = NULL;
+    ck->outputfp = NULL;
+    ck->nfiles = nfiles;
+    ck->out_pos = 0;
+    ck->unrecorded = 0;
+    ck->unsynced = 0;
+    ck->loaded_end = 0;
+    ck->files = calloc(nfiles, sizeof(struct file_progress));
+    if(ck->files == NULL){
+        fprintf(stderr, "Error mallocing.\n");
+        return CHECKPOINT_FAILURE;
+    }
+    return CHECKPOINT_SUCCESS;
+}
+
+void checkpoint_cleanup(struct checkpoint *ck) {
+    int i;
+
+    for(i = 0; i < ck->nfiles; i++)
+        progress_cleanup(&ck->files[i]);
+    free(ck->files);
+    ck->files = NULL;
+}
+
+/* Desc:    Parses a position, two numbers, from a record.
+ * Return:  1 on success, 0 if the record ends early.
+ */
+static int parse_pos(char **pos, struct input_pos *out) {
+    char *end;
+
+    out->offset = strtol(*pos, &end, 10);
+    if(end == *pos)
+        return 0;
+    *pos = end;
+    out->sub = strtol(*pos, &end, 10);
+    if(end == *pos)
+        return 0;
+    *pos = end;
+    return 1;
+}
+
+/* Desc:    Parses one record line into ck, which must be freshly
+ *          initialized.
+ * Return:  CHECKPOINT_SUCCESS if the record is complete.
+ *          CHECKPOINT_NONE if it is truncated or malformed.
+ *          CHECKPOINT_FAILURE on failure.
+ */
+static int parse_record(struct checkpoint *ck, char *line) {
+    struct file_progress *p;
+    struct span span;
+    char *pos, *end;
+    long ndone;
+    int i, j;
+
+    if(strncmp(line, "record ", 7) != 0)
+        return CHECKPOINT_NONE;
+    pos = line + 7;
+
+    ck->out_pos = strtol(pos, &end, 10);
+    if(end == pos)
+        return CHECKPOINT_NONE;
+    pos = end;
+    for(i = 0; i < ck->nfiles; i++){
+        p = &ck->files[i];
+        if(!parse_pos(&pos, &p->watermark))
+            return CHECKPOINT_NONE;
+        ndone = strtol(pos, &end, 10);
+        if(end == pos || ndone < 0)
+            return CHECKPOINT_NONE;
+        pos = end;
+        for(j = 0; j < ndone; j++){
+            if(!parse_pos(&pos, &span.start) || !parse_pos(&pos, &span.end))
+                return CHECKPOINT_NONE;
+            if(progress_add(p, &span) == CHECKPOINT_FAILURE)
+                return CHECKPOINT_FAILURE;
+        }
+    }
+    /* A record cut short by a crash has no end marker */
+    if(strcmp(pos, " end\n") != 0)
+        return CHECKPOINT_NONE;
+
+    return CHECKPOINT_SUCCESS;
+}
+
+int checkpoint_load(struct checkpoint *ck, const char *path,
+        char *names[], long out_size) {
+    FILE *fp;
+    char *line = NULL;
+    size_t line_cap = 0;
+    struct checkpoint record;
+    int nfiles, i, rc;
+    int ret = CHECKPOINT_NONE;
+
+    fp = fopen(path, "r");
+    if(fp == NULL){
+        if(errno == ENOENT)
+            return CHECKPOINT_NONE;
+        fprintf(stderr, "Error opening checkpoint file: %s\n", path);
+        perror("");
+        return CHECKPOINT_FAILURE;
+    }
+
+    /* Check that the header describes the same input files */
+    if(getline(&line, &line_cap, fp) < 0
+            || sscanf(line, CHECKPOINT_MAGIC " %d", &nfiles) != 1
+            || nfiles != ck->nfiles){
+        fprintf(stderr, "The checkpoint file %s does not match the "
+                "input files.\n", path);
+        ret = CHECKPOINT_FAILURE;
+        goto out;
+    }
+    for(i = 0; i < nfiles; i++){
+        if(getline(&line, &line_cap, fp) < 0
+                || strncmp(line, "file ", 5) != 0
+                || strncmp(line + 5, names[i], strlen(names[i])) != 0
+                || strcmp(line + 5 + strlen(names[i]), "\n") != 0){
+            fprintf(stderr, "The checkpoint file %s does not match the "
+                    "input files.\n", path);
+            ret = CHECKPOINT_FAILURE;
+            goto out;
+        }
+    }
+
+    /* Keep the last record that the output file can back up */
+    while(getline(&line, &line_cap, fp) >= 0){
+        if(checkpoint_init(&record, nfiles) == CHECKPOINT_FAILURE){
+            ret = CHECKPOINT_FAILURE;
+            goto out;
+        }
+        rc = parse_record(&record, line);
+        if(rc == CHECKPOINT_SUCCESS && record.out_pos <= out_size){
+            checkpoint_cleanup(ck);
+            *ck = record;
+            ck->loaded_end = ftell(fp);
+            ret = CHECKPOINT_SUCCESS;
+            continue;
+        }
+        checkpoint_cleanup(&record);
+        if(rc == CHECKPOINT_FAILURE){
+            ret = CHECKPOINT_FAILURE;
+            goto out;
+        }
+    }
+
+out:
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+int checkpoint_open(struct checkpoint *ck, const char *path,
+        char *names[], int append, FILE *outputfp) {
+    int i;
+
+    ck->fp = fopen(path, append ? "r+" : "w");
+    if(ck->fp == NULL){
+        fprintf(stderr, "Error opening checkpoint file: %s\n", path);
+        perror("");
+        return CHECKPOINT_FAILURE;
+    }
+    ck->outputfp = outputfp;
+
+    /* Drop the records after the loaded one. They describe output
+     * that was lost, or are incomplete, and would only be skipped
+     * again by every later resume. */
+    if(append && (ftruncate(fileno(ck->fp), ck->loaded_end) != 0
+                || fseek(ck->fp, 0, SEEK_END) != 0)){
+        perror("Error truncating the checkpoint file");
+        return CHECKPOINT_FAILURE;
+    }
+
+    if(!append){
+        fprintf(ck->fp, CHECKPOINT_MAGIC " %d\n", ck->nfiles);
+        for(i = 0; i < ck->nfiles; i++)
+            fprintf(ck->fp, "file %s\n", names[i]);
+        if(fflush(ck->fp) != 0 || fsync(fileno(ck->fp)) != 0){
+            perror("Error writing the checkpoint file");
+            return CHECKPOINT_FAILURE;
+        }
+    }
+
+    return CHECKPOINT_SUCCESS;
+}
+
+int checkpoint_progress_copy(struct checkpoint *ck, int file,
+        struct file_progress *copy) {
+    struct file_progress *p = &ck->files[file];
+
+    copy->watermark = p->watermark;
+    copy->next = 0;
+    copy->ndone = p->ndone;
+    copy->cap = p->ndone;
+    copy->done = NULL;
+    if(p->ndone > 0){
+        copy->done = malloc(sizeof(struct span) * p->ndone);
+        if(copy->done == NULL){
+            fprintf(stderr, "Error mallocing.\n");
+            return CHECKPOINT_FAILURE;
+        }
+        memcpy(copy->done, p->done, sizeof(struct span) * p->ndone);
+    }
+
+    return CHECKPOINT_SUCCESS;
+}
+
+void progress_cleanup(struct file_progress *p) {
+    free(p->done);
+    p->done = NULL;
+    p->ndone = 0;
+    p->cap = 0;
+}
+
+int progress_is_done(struct file_progress *p, struct input_pos start) {
+    /* Starts only grow, so spans that end before this one are
+     * never needed again */
+    while(p->next < p->ndone && !pos_less(start, p->done[p->next].end))
+        p->next++;
+
+    return p->next < p->ndone && !pos_less(start, p->done[p->next].start);
+}
+
+/* Desc:    Appends a record of the current progress. The output
+ *          is flushed first so the record never describes bytes
+ *          that are still buffered. If sync is set, or enough
+ *          records have built up, the output and then the
+ *          checkpoint file are fsync'd.
+ * Return:  CHECKPOINT_SUCCESS on success. CHECKPOINT_FAILURE on failure.
+ */
+static int checkpoint_record(struct checkpoint *ck, int sync) {
+    struct file_progress *p;
+    int i, j;
+
+    ck->unrecorded = 0;
+    if(++ck->unsynced >= CHECKPOINT_SYNC_RECORDS)
+        sync = 1;
+
+    if(fflush(ck->outputfp) != 0){
+        perror("Error flushing the output file");
+        return CHECKPOINT_FAILURE;
+    }
+    if(sync && fsync(fileno(ck->outputfp)) != 0){
+        perror("Error syncing the output file");
+        return CHECKPOINT_FAILURE;
+    }
+
+    fprintf(ck->fp, "record %ld", ck->out_pos);
+    for(i = 0; i < ck->nfiles; i++){
+        p = &ck->files[i];
+        fprintf(ck->fp, " %ld %ld %d", p->watermark.offset,
+                p->watermark.sub, p->ndone);
+        for(j = 0; j < p->ndone; j++)
+            fprintf(ck->fp, " %ld %ld %ld %ld",
+                    p->done[j].start.offset, p->done[j].start.sub,
+                    p->done[j].end.offset, p->done[j].end.sub);
+    }
+    fprintf(ck->fp, " end\n");
+
+    if(fflush(ck->fp) != 0){
+        perror("Error writing the checkpoint file");
+        return CHECKPOINT_FAILURE;
+    }
+    if(sync){
+        if(fsync(fileno(ck->fp)) != 0){
+            perror("Error syncing the checkpoint file");
+            return CHECKPOINT_FAILURE;
+        }
+        ck->unsynced = 0;
+    }
+
+    return CHECKPOINT_SUCCESS;
+}
+
+int checkpoint_done(struct checkpoint *ck, int file,
+        const struct span *span, long written) {
+    struct file_progress *p = &ck->files[file];
+
+    ck->out_pos += written;
+
+    if(pos_equal(span->start, p->watermark)){
+        /* Advance past this span, and past the spans that finished
+         * early if they now follow on. Touching spans are merged,
+         * so only the first one can. */
+        p->watermark = span->end;
+        if(p->ndone > 0 && pos_equal(p->done[0].start, p->watermark)){
+            p->watermark = p->done[0].end;
+            memmove(p->done, p->done + 1,
+                    sizeof(struct span) * (p->ndone - 1));
+            p->ndone--;
+        }
+    } else if(progress_add(p, span) == CHECKPOINT_FAILURE){
+        return CHECKPOINT_FAILURE;
+    }
+
+    if(++ck->unrecorded >= CHECKPOINT_INTERVAL)
+        return checkpoint_record(ck, 0);
+
+    return CHECKPOINT_SUCCESS;
+}
+
+int checkpoint_close(struct checkpoint *ck) {
+    int rc;
+
+    rc = checkpoint_record(ck, 1);
+    if(fclose(ck->fp) != 0){
+        perror("Error closing the checkpoint file");
+        rc = CHECKPOINT_FAILURE;
+    }
+    ck->fp = NULL;
+    checkpoint_cleanup(ck);
+
+    return rc;
+}
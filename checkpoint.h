@@ -0,0 +1,135 @@
+/*
+ * File: checkpoint.h
+ * Description:
+ *      Progress tracking so that an interrupted run can be
+ *      resumed without redoing finished lookups.
+ *
+ *      Every queued name covers a span of its input file.
+ *      Results are written in completion order, so each file
+ *      keeps a watermark below which every span has been written,
+ *      plus the few spans past the watermark that finished early.
+ *      Together with the number of bytes written to the output
+ *      this describes exactly which work is done.
+ *
+ *      The checkpoint file is append only. It starts with a
+ *      header naming the input files, followed by one record
+ *      per CHECKPOINT_INTERVAL results. Every
+ *      CHECKPOINT_SYNC_RECORDS records the output and then the
+ *      checkpoint file are fsync'd.
+ *
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+
+#define CHECKPOINT_FAILURE -1
+#define CHECKPOINT_SUCCESS 0
+#define CHECKPOINT_NONE 1
+
+#define CHECKPOINT_INTERVAL 1000
+#define CHECKPOINT_SYNC_RECORDS 10
+#define CHECKPOINT_MAGIC "tdns-checkpoint"
+
+/* A position in an input file. One line can expand to several
+ * names, such as the addresses of a CIDR range, so sub counts
+ * the names already taken from the line starting at offset. */
+struct input_pos {
+    long offset;
+    long sub;
+};
+
+/* A span of an input file, [start, end). */
+struct span {
+    struct input_pos start;
+    struct input_pos end;
+};
+
+/* The progress through one input file. */
+struct file_progress {
+    struct input_pos watermark; // Every span before this is written.
+    struct span *done;      // Written spans past the watermark, sorted.
+    int ndone;
+    int cap;
+    int next;               // Where progress_is_done left off.
+};
+
+struct checkpoint {
+    FILE *fp;               // The checkpoint file.
+    FILE *outputfp;         // The output file the records describe.
+    int nfiles;
+    struct file_progress *files;
+    long out_pos;           // Bytes written to the output.
+    long unrecorded;        // Results since the last record.
+    int unsynced;           // Records since the last fsync.
+    long loaded_end;        // End of the loaded record in the file.
+};
+
+/* Desc:    Initializes a checkpoint with no progress.
+ * Args:    nfiles: the number of input files.
+ * Return:  CHECKPOINT_SUCCESS on success. CHECKPOINT_FAILURE on failure.
+ */
+int checkpoint_init(struct checkpoint *ck, int nfiles);
+
+/* Desc:    Loads the last usable record of a checkpoint file.
+ *          A record is usable if it is complete and describes no
+ *          more output than out_size bytes.
+ * Args:    path: the checkpoint file.
+ *          names: the input file names. They must match the
+ *          names in the checkpoint's header.
+ *          out_size: the current size of the output file.
+ * Return:  CHECKPOINT_SUCCESS if a record was loaded.
+ *          CHECKPOINT_NONE if there is no checkpoint file or
+ *          no usable record. CHECKPOINT_FAILURE on failure.
+ */
+int checkpoint_load(struct checkpoint *ck, const char *path,
+        char *names[], long out_size);
+
+/* Desc:    Opens the checkpoint file for writing records.
+ * Args:    append: if 0 the file is truncated and a new header
+ *          is written, otherwise the file is cut after the record
+ *          checkpoint_load loaded and records are appended to it.
+ *          outputfp: the output file, which is flushed and
+ *          synced before each record is written.
+ * Return:  CHECKPOINT_SUCCESS on success. CHECKPOINT_FAILURE on failure.
+ */
+int checkpoint_open(struct checkpoint *ck, const char *path,
+        char *names[], int append, FILE *outputfp);
+
+/* Desc:    Copies the progress through one input file, so that
+ *          a reader can consult it while results are recorded.
+ * Return:  CHECKPOINT_SUCCESS on success. CHECKPOINT_FAILURE on failure.
+ */
+int checkpoint_progress_copy(struct checkpoint *ck, int file,
+        struct file_progress *copy);
+
+/* Desc:    Returns 1 if the span starting at start was written
+ *          past the watermark, 0 otherwise. start must not go
+ *          backwards between calls on the same copy, which lets
+ *          a reader check each line in constant amortized time.
+ */
+int progress_is_done(struct file_progress *p, struct input_pos start);
+
+/* Desc:    Frees a copy made by checkpoint_progress_copy. */
+void progress_cleanup(struct file_progress *p);
+
+/* Desc:    Records that a result was written. Not thread safe,
+ *          call it while holding the output mutex.
+ * Args:    file, span: the input span of the result.
+ *          written: the number of bytes written to the output.
+ * Return:  CHECKPOINT_SUCCESS on success. CHECKPOINT_FAILURE on failure.
+ */
+int checkpoint_done(struct checkpoint *ck, int file,
+        const struct span *span, long written);
+
+/* Desc:    Writes a final record, syncs and closes the
+ *          checkpoint file, then frees the checkpoint.
+ * Return:  CHECKPOINT_SUCCESS on success. CHECKPOINT_FAILURE on failure.
+ */
+int checkpoint_close(struct checkpoint *ck);
+
+/* Desc:    Frees a checkpoint that was never opened. */
+void checkpoint_cleanup(struct checkpoint *ck);
+
+#endif
@@ -0,0 +1,504 @@
+/*
+ * File: daemon.c
+ * Description:
+ *      A resident daemon that runs jobs for clients over a
+ *      Unix domain socket, and the thin client that submits
+ *      them.
+ *
+ *      The client opens its files and passes the descriptors
+ *      with SCM_RIGHTS, so a batch of any size costs one small
+ *      message: the daemon reads the inputs and writes the
+ *      output itself. Each client gets a thread that runs its
+ *      job on the shared queue and writers, then answers with
+ *      the job's status.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "queue.h"
+#include "resolve.h"
+#include "checkpoint.h"
+#include "reorder.h"
+#include "normalize.h"
+#include "tdns.h"
+#include "daemon.h"
+
+/* How long to wait before accepting again when out of descriptors */
+#define ACCEPT_RETRY_SLEEP 10000
+
+struct daemon_client {
+    int fd;
+    struct consumer_args *cargs;
+    int *jobs;                  // Jobs running. Guarded by the status mutex.
+};
+
+/* Watches a client's socket while its job runs */
+struct client_watch {
+    int fd;                     // The client's socket.
+    int wake[2];                // A pipe written to once the job is done.
+    struct job *job;
+};
+
+/* Descriptors passed besides the inputs: the output and stderr */
+#define EXTRA_FDS 2
+
+/* Room for the descriptors of the largest request */
+union daemon_control {
+    char buf[CMSG_SPACE(sizeof(int) * (MAX_CLIENT_FILES + EXTRA_FDS))];
+    struct cmsghdr align;
+};
+
+/* Desc:    Fills in the address of the socket at path.
+ * Return:  DAEMON_SUCCESS on success. DAEMON_FAILURE if the path
+ *          is too long.
+ */
+static int socket_addr(struct sockaddr_un *addr, const char *path) {
+    if(strlen(path) >= sizeof(addr->sun_path)){
+        fprintf(stderr, "The socket path is too long: %s\n", path);
+        return DAEMON_FAILURE;
+    }
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+
+    return DAEMON_SUCCESS;
+}
+
+/* Desc:    Binds and listens on the socket at path.
+ * Return:  The listening socket, or DAEMON_FAILURE.
+ */
+static int daemon_listen(const char *path) {
+    struct sockaddr_un addr;
+    int fd, probe, rc;
+
+    if(socket_addr(&addr, path) == DAEMON_FAILURE)
+        return DAEMON_FAILURE;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){
+        perror("Error creating the socket");
+        return DAEMON_FAILURE;
+    }
+
+    rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if(rc != 0 && errno == EADDRINUSE){
+        /* Replace the socket only if nothing answers on it */
+        probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(probe >= 0 && connect(probe, (struct sockaddr *)&addr,
+                    sizeof(addr)) != 0 && errno == ECONNREFUSED){
+            unlink(path);
+            rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        } else {
+            fprintf(stderr, "A daemon is already listening on %s\n", path);
+            errno = EADDRINUSE;
+        }
+        if(probe >= 0)
+            close(probe);
+    }
+    if(rc != 0 || listen(fd, DAEMON_BACKLOG) != 0){
+        perror("Error listening on the socket");
+        close(fd);
+        return DAEMON_FAILURE;
+    }
+
+    return fd;
+}
+
+/* Desc:    Reads a request and the descriptors passed with it.
+ *          Prints an error unless the client sent nothing.
+ * Args:    fds: room for MAX_CLIENT_FILES + EXTRA_FDS descriptors.
+ *          nfds: receives the number of descriptors. They must
+ *          be closed by the caller even if the call fails.
+ * Return:  DAEMON_SUCCESS on success. DAEMON_FAILURE on failure.
+ */
+static int recv_request(int fd, struct daemon_request *req, int *fds,
+        int *nfds) {
+    union daemon_control control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    size_t total;
+    ssize_t got;
+    int n;
+
+    *nfds = 0;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = req;
+    iov.iov_len = sizeof(struct daemon_request);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    got = recvmsg(fd, &msg, 0);
+    if(got == 0)
+        return DAEMON_FAILURE;
+    if(got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+        fprintf(stderr, "A client sent no request within %d seconds.\n",
+                DAEMON_RECV_TIMEOUT);
+        return DAEMON_FAILURE;
+    }
+    if(got < 0){
+        perror("Error reading a request from a client");
+        return DAEMON_FAILURE;
+    }
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+            cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if(n > MAX_CLIENT_FILES + EXTRA_FDS - *nfds)
+            n = MAX_CLIENT_FILES + EXTRA_FDS - *nfds;
+        memcpy(fds + *nfds, CMSG_DATA(cmsg), n * sizeof(int));
+        *nfds += n;
+    }
+    if(msg.msg_flags & MSG_CTRUNC){
+        fprintf(stderr, "Too many files passed by a client.\n");
+        return DAEMON_FAILURE;
+    }
+
+    /* Read the rest of the request if it was split */
+    for(total = got; total < sizeof(struct daemon_request); total += got){
+        got = read(fd, (char *)req + total,
+                sizeof(struct daemon_request) - total);
+        if(got <= 0){
+            fprintf(stderr, "Error reading a request from a client.\n");
+            return DAEMON_FAILURE;
+        }
+    }
+
+    return DAEMON_SUCCESS;
+}
+
+/* Desc:    Adds n to the number of running jobs, and tells the
+ *          writers whether to expect work.
+ */
+static void jobs_add(struct daemon_client *client, int n) {
+    struct consumer_args *cargs = client->cargs;
+
+    if(pthread_mutex_lock(cargs->status_mutex) != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return;
+    }
+    *client->jobs += n;
+    *cargs->reader_stat = *client->jobs > 0 ? PROCESSING : IDLE;
+    /* Wake the writers waiting for a job */
+    if(pthread_cond_broadcast(cargs->status_cond) != 0)
+        fprintf(stderr, "There was an error signalling the writers.\n");
+    if(pthread_mutex_unlock(cargs->status_mutex) != 0)
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+}
+
+/* Desc:    The thread function that cancels a job if its client
+ *          hangs up, say on Ctrl-C, so the daemon does not go on
+ *          looking up names no one will read. The client sends
+ *          nothing after its request, so any event on its socket
+ *          means it is gone.
+ * Args:    Pointer to a client_watch.
+ * Return:  NULL
+ */
+static void *watch_client(void *arg) {
+    struct client_watch *watch = arg;
+    struct pollfd fds[2];
+    int rc;
+
+    fds[0].fd = watch->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = watch->wake[0];
+    fds[1].events = POLLIN;
+    do {
+        rc = poll(fds, 2, -1);
+    } while(rc < 0 && errno == EINTR);
+    if(rc < 0){
+        perror("Error watching a client");
+        return NULL;
+    }
+    if(fds[1].revents == 0 && fds[0].revents != 0){
+        fprintf(stderr, "A client hung up, so its job was cancelled.\n");
+        job_cancel(watch->job);
+    }
+
+    return NULL;
+}
+
+/* Desc:    Runs a client's job.
+ * Args:    fps: the input files followed by the output file and
+ *          the client's stderr.
+ * Return:  DAEMON_SUCCESS on success. DAEMON_FAILURE on failure.
+ */
+static int run_client_job(struct daemon_client *client,
+        const struct daemon_request *req, FILE **fps) {
+    struct job job;
+    struct reorder ro;
+    struct client_watch watch;
+    pthread_t watcher;
+    int rc, watching;
+
+    if(job_init(&job, fps[req->nfiles]) != 0)
+        return DAEMON_FAILURE;
+    job.errfp = fps[req->nfiles + 1];
+    job.follow_cname = req->follow_cname;
+    job.reverse = req->reverse;
+    job.idn = req->idn;
+    if(req->order != ORDER_NONE){
+        if(reorder_init(&ro, req->order, req->nfiles, req->window)
+                == REORDER_FAILURE){
+            job_cleanup(&job);
+            return DAEMON_FAILURE;
+        }
+        job.reorder = &ro;
+    }
+
+    /* Cancel the job if the client hangs up */
+    watch.fd = client->fd;
+    watch.job = &job;
+    watching = pipe(watch.wake) == 0;
+    if(watching && pthread_create(&watcher, NULL, watch_client, &watch) != 0){
+        close(watch.wake[0]);
+        close(watch.wake[1]);
+        watching = 0;
+    }
+    if(!watching)
+        fprintf(stderr, "Could not watch a client, so its job cannot be "
+                "cancelled.\n");
+
+    jobs_add(client, 1);
+    rc = run_job(client->cargs, &job, fps, req->nfiles);
+    jobs_add(client, -1);
+
+    /* Wake the watcher and wait for it */
+    if(watching){
+        if(write(watch.wake[1], "", 1) < 0)
+            perror("Error waking a client's watcher");
+        pthread_join(watcher, NULL);
+        close(watch.wake[0]);
+        close(watch.wake[1]);
+    }
+    if(fflush(job.outputfp) != 0){
+        perror("Error writing a client's output");
+        rc = 1;
+    }
+
+    if(job.reorder != NULL)
+        reorder_cleanup(&ro);
+    job_cleanup(&job);
+
+    return rc == 0 ? DAEMON_SUCCESS : DAEMON_FAILURE;
+}
+
+/* Desc:    The thread function serving one client.
+ * Args:    Pointer to a heap allocated daemon_client, which is
+ *          freed before returning.
+ * Return:  NULL
+ */
+static void *serve_client(void *arg) {
+    struct daemon_client *client = arg;
+    struct daemon_request req;
+    int fds[MAX_CLIENT_FILES + EXTRA_FDS];
+    FILE *fps[MAX_CLIENT_FILES + EXTRA_FDS];
+    int i, rc, nfds, nfps = 0;
+    int status = DAEMON_FAILURE;
+
+    rc = recv_request(client->fd, &req, fds, &nfds);
+    if(rc == DAEMON_SUCCESS && (req.nfiles < 1
+            || req.nfiles > MAX_CLIENT_FILES
+            || nfds != req.nfiles + EXTRA_FDS || req.window < 2
+            || req.window > MAX_CLIENT_WINDOW
+            || req.window * req.nfiles > MAX_CLIENT_SLOTS
+            || (req.order != ORDER_NONE && req.order != ORDER_INPUT
+                && req.order != ORDER_FILE))){
+        fprintf(stderr, "Invalid request from a client.\n");
+        rc = DAEMON_FAILURE;
+    }
+    if(rc == DAEMON_SUCCESS){
+        /* The inputs come first, then the output and stderr */
+        for(nfps = 0; nfps < nfds; nfps++){
+            fps[nfps] = fdopen(fds[nfps], nfps < req.nfiles ? "r" : "w");
+            if(fps[nfps] == NULL){
+                perror("Error opening a client's file");
+                break;
+            }
+        }
+        if(nfps == nfds){
+            /* Line buffer the client's stderr like a terminal */
+            setvbuf(fps[req.nfiles + 1], NULL, _IOLBF, 0);
+            if(req.idn && !normalize_can_fold())
+                fprintf(fps[req.nfiles + 1], "--idn needs a UTF-8 locale "
+                        "to case fold names, and the daemon has none.\n");
+            else
+                status = run_client_job(client, &req, fps);
+        }
+    }
+
+    /* Close the files, then tell the client how it went */
+    for(i = 0; i < nfps; i++){
+        if(fclose(fps[i]) != 0 && i == req.nfiles){
+            perror("Error closing a client's output");
+            status = DAEMON_FAILURE;
+        }
+    }
+    for(i = nfps; i < nfds; i++)
+        close(fds[i]);
+    if(send(client->fd, &status, sizeof(status), MSG_NOSIGNAL) < 0
+            && errno != EPIPE)
+        perror("Error answering a client");
+    close(client->fd);
+    free(client);
+
+    return NULL;
+}
+
+int daemon_run(const char *path, struct consumer_args *cargs) {
+    struct daemon_client *client;
+    struct timeval timeout = {DAEMON_RECV_TIMEOUT, 0};
+    pthread_attr_t attr;
+    pthread_t thread;
+    int listenfd, fd, rc;
+    int jobs = 0;
+
+    /* A client or an output pipe that goes away must not take
+     * the daemon with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    listenfd = daemon_listen(path);
+    if(listenfd == DAEMON_FAILURE)
+        return DAEMON_FAILURE;
+    rc = pthread_attr_init(&attr);
+    rc = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) || rc;
+    if(rc != 0){
+        fprintf(stderr, "There was an error initializing the thread attributes.\n");
+        close(listenfd);
+        return DAEMON_FAILURE;
+    }
+
+    while(1){
+        fd = accept(listenfd, NULL, NULL);
+        if(fd < 0){
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if(errno == EMFILE || errno == ENFILE){
+                usleep(ACCEPT_RETRY_SLEEP);
+                continue;
+            }
+            perror("Error accepting a client");
+            break;
+        }
+        /* A client that never sends its request must not hold a
+         * thread forever */
+        if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                    sizeof(timeout)) != 0){
+            perror("Error setting a client's timeout");
+            close(fd);
+            continue;
+        }
+        client = malloc(sizeof(struct daemon_client));
+        if(client == NULL){
+            fprintf(stderr, "Error mallocing.\n");
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->cargs = cargs;
+        client->jobs = &jobs;
+        rc = pthread_create(&thread, &attr, serve_client, client);
+        if(rc){
+            fprintf(stderr, "ERROR: Return code from pthread_create() is %d\n", rc);
+            close(fd);
+            free(client);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    close(listenfd);
+
+    return DAEMON_FAILURE;
+}
+
+int client_run(const char *path, const struct daemon_request *req,
+        FILE **inputfps, FILE *outputfp) {
+    union daemon_control control;
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int fds[MAX_CLIENT_FILES + EXTRA_FDS];
+    int nfds = req->nfiles + EXTRA_FDS;
+    int i, sock, status;
+    ssize_t got;
+
+    if(req->nfiles > MAX_CLIENT_FILES){
+        fprintf(stderr, "At most %d input files can be passed to the "
+                "daemon.\n", MAX_CLIENT_FILES);
+        return DAEMON_FAILURE;
+    }
+    if(req->window > MAX_CLIENT_WINDOW
+            || req->window * req->nfiles > MAX_CLIENT_SLOTS){
+        fprintf(stderr, "The daemon takes a window of at most %d, and "
+                "at most %ld results held across all input files.\n",
+                MAX_CLIENT_WINDOW, MAX_CLIENT_SLOTS);
+        return DAEMON_FAILURE;
+    }
+    fflush(stderr);
+    for(i = 0; i < req->nfiles; i++)
+        fds[i] = fileno(inputfps[i]);
+    fds[req->nfiles] = fileno(outputfp);
+    fds[req->nfiles + 1] = fileno(stderr);
+
+    if(socket_addr(&addr, path) == DAEMON_FAILURE)
+        return DAEMON_FAILURE;
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(sock < 0){
+        perror("Error creating the socket");
+        return DAEMON_FAILURE;
+    }
+    if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+        perror("Error connecting to the daemon");
+        close(sock);
+        return DAEMON_FAILURE;
+    }
+
+    /* Send the request with the files attached */
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = (void *)req;
+    iov.iov_len = sizeof(struct daemon_request);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    if(sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(struct daemon_request)){
+        perror("Error sending the job to the daemon");
+        close(sock);
+        return DAEMON_FAILURE;
+    }
+
+    /* The daemon answers once the job is done */
+    got = recv(sock, &status, sizeof(status), MSG_WAITALL);
+    close(sock);
+    if(got != (ssize_t)sizeof(status)){
+        fprintf(stderr, "The daemon closed the connection before the "
+                "job finished.\n");
+        return DAEMON_FAILURE;
+    }
+    if(status != DAEMON_SUCCESS){
+        fprintf(stderr, "The daemon could not run the job.\n");
+        return DAEMON_FAILURE;
+    }
+
+    return DAEMON_SUCCESS;
+}
@@ -0,0 +1,66 @@
+/*
+ * File: daemon.h
+ * Description:
+ *      A resident daemon that runs jobs for clients over a
+ *      Unix domain socket, and the thin client that submits
+ *      them. The client passes its open files to the daemon,
+ *      so results go straight to the client's output.
+ *
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdio.h>
+
+#define DAEMON_FAILURE -1
+#define DAEMON_SUCCESS 0
+
+/* The kernel passes at most 253 descriptors in one message.
+ * The output file and stderr take two of them. */
+#define MAX_CLIENT_FILES 251
+#define DAEMON_BACKLOG 16
+/* Seconds a client has to send its request */
+#define DAEMON_RECV_TIMEOUT 5
+/* Bounds on the reorder buffer a client can ask for */
+#define MAX_CLIENT_WINDOW 65536
+#define MAX_CLIENT_SLOTS (1L << 20)     // Window times input files.
+
+struct consumer_args;
+
+/* Sent by the client along with the files. The input files
+ * come first, then the output file, then the client's stderr,
+ * which gets the job's rejections and lookup errors. */
+struct daemon_request {
+    int follow_cname;
+    int reverse;
+    int idn;
+    int order;                  // ORDER_NONE, ORDER_INPUT or ORDER_FILE.
+    long window;
+    int nfiles;                 // Number of input files.
+};
+
+/* Desc:    Listens on the socket at path and runs a job for each
+ *          client, using the writers already started with cargs.
+ *          A stale socket left by a daemon that is no longer
+ *          running is replaced.
+ * Args:    path: the path of the socket.
+ *          cargs: the args the writers were started with.
+ *          Its reader_stat is set to PROCESSING while there are
+ *          jobs and IDLE while there are none.
+ * Return:  DAEMON_FAILURE. It only returns if it cannot serve.
+ */
+int daemon_run(const char *path, struct consumer_args *cargs);
+
+/* Desc:    Submits a job to the daemon listening at path and
+ *          waits for it to finish. The job's diagnostics are
+ *          written to this process's stderr by the daemon.
+ * Args:    req: the job's options and number of input files.
+ *          inputfps: the open input files.
+ *          outputfp: the open output file.
+ * Return:  DAEMON_SUCCESS if the job ran. DAEMON_FAILURE otherwise.
+ */
+int client_run(const char *path, const struct daemon_request *req,
+        FILE **inputfps, FILE *outputfp);
+
+#endif
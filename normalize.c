@@ -0,0 +1,368 @@
+/*
+ * File: normalize.c
+ * Description:
+ *      Normalization and validation of domain names as they
+ *      are read, so junk never reaches the resolver.
+ *
+ *      Names are checked in one pass over their bytes. Each
+ *      byte is classified with a single table lookup, and the
+ *      table also tells uppercase letters apart so they can be
+ *      folded in the same pass. Only labels that contain
+ *      non-ASCII bytes take the slower IDN path.
+ *
+ */
+
+#include <string.h>
+#include <locale.h>
+#include <wctype.h>
+
+#include "normalize.h"
+
+/* Byte classes */
+#define CC_BAD 0
+#define CC_LDH 1        // Lowercase letter, digit or '_'.
+#define CC_UPPER 2
+#define CC_HYPHEN 3
+#define CC_DOT 4
+#define CC_SPACE 5
+#define CC_HIGH 6       // Part of a multibyte UTF-8 sequence.
+
+/* Filled in by normalize_init */
+static unsigned char char_class[256];
+static int can_fold;            // Whether a Unicode locale was set.
+
+/* Locales that can case fold non-ASCII letters, tried in order */
+static const char *fold_locales[] = {"C.UTF-8", "C.utf8", ""};
+
+/* RFC 3492 parameters */
+#define PUNY_BASE 36
+#define PUNY_TMIN 1
+#define PUNY_TMAX 26
+#define PUNY_SKEW 38
+#define PUNY_DAMP 700
+#define PUNY_INITIAL_BIAS 72
+#define PUNY_INITIAL_N 0x80
+
+static const char *name_errors[] = {
+    "ok",
+    "blank",
+    "name-too-long",
+    "label-too-long",
+    "empty-label",
+    "invalid-character",
+    "bad-hyphen",
+    "non-ascii",
+    "invalid-utf8",
+};
+
+int normalize_init(int idn) {
+    int i;
+
+    memset(char_class, CC_BAD, sizeof(char_class));
+    for(i = '0'; i <= '9'; i++)
+        char_class[i] = CC_LDH;
+    for(i = 'a'; i <= 'z'; i++)
+        char_class[i] = CC_LDH;
+    for(i = 'A'; i <= 'Z'; i++)
+        char_class[i] = CC_UPPER;
+    for(i = 0x80; i <= 0xff; i++)
+        char_class[i] = CC_HIGH;
+    char_class['_'] = CC_LDH;
+    char_class['-'] = CC_HYPHEN;
+    char_class['.'] = CC_DOT;
+    char_class[' '] = CC_SPACE;
+    char_class['\t'] = CC_SPACE;
+    char_class['\r'] = CC_SPACE;
+    char_class['\v'] = CC_SPACE;
+    char_class['\f'] = CC_SPACE;
+
+    if(!idn)
+        return 0;
+    /* towlower only knows non-ASCII letters in a Unicode locale */
+    for(i = 0; i < (int)(sizeof(fold_locales) / sizeof(fold_locales[0])); i++){
+        if(setlocale(LC_CTYPE, fold_locales[i]) != NULL
+                && towlower(0xdc) == 0xfc){
+            can_fold = 1;
+            return 0;
+        }
+    }
+    setlocale(LC_CTYPE, "C");
+
+    return 1;
+}
+
+int normalize_can_fold(void) {
+    return can_fold;
+}
+
+const char *normalize_strerror(int code) {
+    if(code < 0 || code >= (int)(sizeof(name_errors) / sizeof(name_errors[0])))
+        return "unknown";
+    return name_errors[code];
+}
+
+/* Desc:    Decodes one label of UTF-8 into code points.
+ * Args:    cps: room for at least len code points.
+ * Return:  The number of code points, or -NAME_BAD_UTF8.
+ */
+static int utf8_decode(const unsigned char *in, int len, unsigned int *cps) {
+    unsigned int cp, min;
+    int i = 0, n = 0, extra, j;
+
+    while(i < len){
+        if(in[i] < 0x80){
+            cps[n++] = in[i++];
+            continue;
+        } else if((in[i] & 0xe0) == 0xc0){
+            cp = in[i] & 0x1f;
+            extra = 1;
+            min = 0x80;
+        } else if((in[i] & 0xf0) == 0xe0){
+            cp = in[i] & 0x0f;
+            extra = 2;
+            min = 0x800;
+        } else if((in[i] & 0xf8) == 0xf0){
+            cp = in[i] & 0x07;
+            extra = 3;
+            min = 0x10000;
+        } else {
+            return -NAME_BAD_UTF8;
+        }
+        if(i + extra >= len)
+            return -NAME_BAD_UTF8;
+        for(j = 1; j <= extra; j++){
+            if((in[i+j] & 0xc0) != 0x80)
+                return -NAME_BAD_UTF8;
+            cp = (cp << 6) | (in[i+j] & 0x3f);
+        }
+        /* Reject overlong forms, surrogates and out of range values */
+        if(cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+            return -NAME_BAD_UTF8;
+        cps[n++] = cp;
+        i += extra + 1;
+    }
+
+    return n;
+}
+
+static int puny_adapt(unsigned int delta, unsigned int numpoints, int first) {
+    unsigned int k = 0;
+
+    delta = first ? delta / PUNY_DAMP : delta / 2;
+    delta += delta / numpoints;
+    while(delta > ((PUNY_BASE - PUNY_TMIN) * PUNY_TMAX) / 2){
+        delta /= PUNY_BASE - PUNY_TMIN;
+        k += PUNY_BASE;
+    }
+
+    return k + (PUNY_BASE - PUNY_TMIN + 1) * delta / (delta + PUNY_SKEW);
+}
+
+static char puny_digit(unsigned int d) {
+    return d < 26 ? 'a' + d : '0' + (d - 26);
+}
+
+/* Desc:    Punycode encodes code points as described in RFC 3492.
+ * Args:    out: buffer of size out_size. It is not terminated.
+ * Return:  The number of characters written, or -1 if they do
+ *          not fit.
+ */
+static int puny_encode(const unsigned int *cps, int n, char *out, int out_size) {
+    unsigned int cp = PUNY_INITIAL_N;
+    unsigned int delta = 0, bias = PUNY_INITIAL_BIAS;
+    unsigned int m, q, t, k;
+    int h, b, i, len = 0;
+
+    for(i = 0; i < n; i++){
+        if(cps[i] < 0x80){
+            if(len >= out_size)
+                return -1;
+            out[len++] = cps[i];
+        }
+    }
+    h = b = len;
+    if(b > 0){
+        if(len >= out_size)
+            return -1;
+        out[len++] = '-';
+    }
+
+    while(h < n){
+        /* The smallest code point not handled yet */
+        m = 0xffffffff;
+        for(i = 0; i < n; i++){
+            if(cps[i] >= cp && cps[i] < m)
+                m = cps[i];
+        }
+        delta += (m - cp) * (h + 1);
+        cp = m;
+        for(i = 0; i < n; i++){
+            if(cps[i] < cp)
+                delta++;
+            if(cps[i] != cp)
+                continue;
+            q = delta;
+            for(k = PUNY_BASE; ; k += PUNY_BASE){
+                if(k <= bias)
+                    t = PUNY_TMIN;
+                else if(k >= bias + PUNY_TMAX)
+                    t = PUNY_TMAX;
+                else
+                    t = k - bias;
+                if(q < t)
+                    break;
+                if(len >= out_size)
+                    return -1;
+                out[len++] = puny_digit(t + (q - t) % (PUNY_BASE - t));
+                q = (q - t) / (PUNY_BASE - t);
+            }
+            if(len >= out_size)
+                return -1;
+            out[len++] = puny_digit(q);
+            bias = puny_adapt(delta, h + 1, h == b);
+            delta = 0;
+            h++;
+        }
+        delta++;
+        cp++;
+    }
+
+    return len;
+}
+
+/* Desc:    Converts a label with non-ASCII characters to its
+ *          ACE form, "xn--" followed by the punycode.
+ * Args:    out: room for at least MAX_LABEL_LENGTH characters.
+ * Return:  The length of the label, or -NAME_* on failure.
+ */
+static int idn_label(const unsigned char *in, int len, char *out) {
+    unsigned int cps[len];
+    int n, i, rc, high = 0;
+
+    n = utf8_decode(in, len, cps);
+    if(n < 0)
+        return n;
+    /* Case fold, so that case variants get the same label. The
+     * ASCII characters must still be valid on their own. */
+    for(i = 0; i < n; i++){
+        if(cps[i] >= 0x80)
+            cps[i] = towlower(cps[i]);
+        if(cps[i] >= 0x80){
+            high = 1;
+            continue;
+        }
+        switch(char_class[cps[i]]){
+            case CC_UPPER:
+                cps[i] |= 0x20;
+                break;
+            case CC_LDH:
+            case CC_HYPHEN:
+                break;
+            default:
+                return -NAME_BAD_CHAR;
+        }
+    }
+    if(cps[0] == '-' || cps[n-1] == '-')
+        return -NAME_BAD_HYPHEN;
+
+    /* Folding can leave only ASCII, as with the Kelvin sign */
+    if(!high){
+        if(n > MAX_LABEL_LENGTH)
+            return -NAME_LABEL_TOO_LONG;
+        for(i = 0; i < n; i++)
+            out[i] = cps[i];
+        return n;
+    }
+
+    memcpy(out, ACE_PREFIX, strlen(ACE_PREFIX));
+    rc = puny_encode(cps, n, out + strlen(ACE_PREFIX),
+            MAX_LABEL_LENGTH - strlen(ACE_PREFIX));
+    if(rc < 0)
+        return -NAME_LABEL_TOO_LONG;
+
+    return rc + strlen(ACE_PREFIX);
+}
+
+/* Desc:    Normalizes one label, the fast path for ASCII.
+ * Args:    out: room for at least MAX_LABEL_LENGTH characters.
+ * Return:  The length of the label, or -NAME_* on failure.
+ */
+static int normalize_label(const unsigned char *in, int len, char *out,
+        int idn) {
+    int i, high = 0;
+
+    if(len == 0)
+        return -NAME_EMPTY_LABEL;
+
+    for(i = 0; i < len; i++){
+        switch(char_class[in[i]]){
+            case CC_LDH:
+            case CC_HYPHEN:
+                if(i < MAX_LABEL_LENGTH)
+                    out[i] = in[i];
+                break;
+            case CC_UPPER:
+                if(i < MAX_LABEL_LENGTH)
+                    out[i] = in[i] | 0x20;
+                break;
+            case CC_HIGH:
+                if(!idn)
+                    return -NAME_NON_ASCII;
+                high = 1;
+                break;
+            default:
+                return -NAME_BAD_CHAR;
+        }
+    }
+    if(high)
+        return idn_label(in, len, out);
+
+    if(in[0] == '-' || in[len-1] == '-')
+        return -NAME_BAD_HYPHEN;
+    if(len > MAX_LABEL_LENGTH)
+        return -NAME_LABEL_TOO_LONG;
+
+    return len;
+}
+
+int normalize_name(const char *in, char *out, int out_size, int idn) {
+    const unsigned char *start = (const unsigned char *)in;
+    const unsigned char *end, *label, *dot;
+    char label_buf[MAX_LABEL_LENGTH];
+    int limit, pos = 0, n;
+
+    /* Trim surrounding whitespace and one trailing dot */
+    while(char_class[*start] == CC_SPACE)
+        start++;
+    end = start + strlen((const char *)start);
+    while(end > start && char_class[end[-1]] == CC_SPACE)
+        end--;
+    if(end == start)
+        return NAME_BLANK;
+    if(end[-1] == '.')
+        end--;
+
+    limit = out_size - 1;
+    if(limit > MAX_DOMAIN_LENGTH)
+        limit = MAX_DOMAIN_LENGTH;
+
+    label = start;
+    while(1){
+        dot = memchr(label, '.', end - label);
+        n = normalize_label(label, (dot ? dot : end) - label, label_buf, idn);
+        if(n < 0)
+            return -n;
+        if(pos + (pos > 0) + n > limit)
+            return NAME_TOO_LONG;
+        if(pos > 0)
+            out[pos++] = '.';
+        memcpy(out + pos, label_buf, n);
+        pos += n;
+        if(dot == NULL)
+            break;
+        label = dot + 1;
+    }
+    out[pos] = '\0';
+
+    return NAME_OK;
+}
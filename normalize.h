@@ -0,0 +1,60 @@
+/*
+ * File: normalize.h
+ * Description:
+ *      Normalization and validation of domain names as they
+ *      are read, so junk never reaches the resolver.
+ *
+ */
+
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+
+#define NAME_OK 0
+#define NAME_BLANK 1            // Nothing but whitespace.
+#define NAME_TOO_LONG 2         // Over MAX_DOMAIN_LENGTH.
+#define NAME_LABEL_TOO_LONG 3   // A label over MAX_LABEL_LENGTH.
+#define NAME_EMPTY_LABEL 4      // Leading or doubled dot.
+#define NAME_BAD_CHAR 5         // Not a letter, digit, '-' or '_'.
+#define NAME_BAD_HYPHEN 6       // A label starts or ends with '-'.
+#define NAME_NON_ASCII 7        // Non-ASCII without IDN conversion.
+#define NAME_BAD_UTF8 8         // Malformed UTF-8.
+
+/* RFC 1035 limits, in the textual form without the final dot */
+#define MAX_LABEL_LENGTH 63
+#define MAX_DOMAIN_LENGTH 253
+
+#define ACE_PREFIX "xn--"
+
+/* Desc:    Fills in the tables normalize_name uses. Must be
+ *          called before any thread calls normalize_name.
+ * Args:    idn: if non-zero, also sets up case folding of non-ASCII
+ *          letters, which changes LC_CTYPE to a Unicode locale.
+ * Return:  0 on success. 1 if idn is set and no Unicode locale is
+ *          available.
+ */
+int normalize_init(int idn);
+
+/* Desc:    Returns 1 if normalize_init set up case folding of
+ *          non-ASCII letters, which --idn needs, 0 otherwise.
+ */
+int normalize_can_fold(void);
+
+/* Desc:    Normalizes a domain name. Surrounding whitespace and
+ *          one trailing dot are removed and ASCII letters are
+ *          lowercased. The result is checked against the length
+ *          limits and the letters, digits, hyphen rule, with
+ *          '_' also allowed since it is common in practice.
+ * Args:    in: the name as read, ending with \0.
+ *          out: buffer of size out_size for the normalized name.
+ *          idn: if non-zero, labels with non-ASCII characters
+ *          are converted to punycode instead of rejected, after
+ *          case folding them with towlower.
+ * Return:  NAME_OK if out holds a valid name. NAME_BLANK if the
+ *          line is blank. Otherwise the reason it was rejected.
+ */
+int normalize_name(const char *in, char *out, int out_size, int idn);
+
+/* Desc:    Returns a short string naming a NAME_* code. */
+const char *normalize_strerror(int code);
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * File: reorder.c
+ * Description:
+ *      A bounded reorder buffer that releases results in input
+ *      order even though they finish in any order.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "reorder.h"
+
+int reorder_init(struct reorder *ro, int mode, int nfiles, long window) {
+    int i, rc;
+
+    if(window < 2)
+        window = 2;
+    ro->mode = mode;
+    ro->nfiles = nfiles;
+    ro->window = window;
+    ro->buffered = 0;
+    ro->current = (mode == ORDER_INPUT) ? 0 : -1;
+
+    ro->files = calloc(nfiles, sizeof(struct reorder_file));
+    if(ro->files == NULL){
+        fprintf(stderr, "Error mallocing.\n");
+        return REORDER_FAILURE;
+    }
+    for(i = 0; i < nfiles; i++){
+        ro->files[i].slots = calloc(window, sizeof(void *));
+        if(ro->files[i].slots == NULL){
+            fprintf(stderr, "Error mallocing.\n");
+            reorder_cleanup(ro);
+            return REORDER_FAILURE;
+        }
+    }
+
+    rc = pthread_mutex_init(&ro->mutex, NULL);
+    if(rc != 0){
+        fprintf(stderr, "There was an error initializing the mutex.\n");
+        return REORDER_FAILURE;
+    }
+
+    return REORDER_SUCCESS;
+}
+
+long reorder_admit(struct reorder *ro, int file) {
+    long limit, seq;
+    int rc;
+
+    rc = pthread_mutex_lock(&ro->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return REORDER_FAILURE;
+    }
+    /* Files that are not being released leave half the window
+     * to the one that is, so a slow file cannot stall it. */
+    if(file == ro->current)
+        limit = ro->window;
+    else
+        limit = ro->window - ro->window / 2;
+    if(ro->buffered < limit){
+        seq = ro->files[file].admitted++;
+        ro->buffered++;
+    } else {
+        seq = REORDER_FULL;
+    }
+    rc = pthread_mutex_unlock(&ro->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+        return REORDER_FAILURE;
+    }
+
+    return seq;
+}
+
+int reorder_put(struct reorder *ro, int file, long seq, void *result) {
+    int rc;
+
+    rc = pthread_mutex_lock(&ro->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return REORDER_FAILURE;
+    }
+    ro->files[file].slots[seq % ro->window] = result;
+    rc = pthread_mutex_unlock(&ro->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+        return REORDER_FAILURE;
+    }
+
+    return REORDER_SUCCESS;
+}
+
+int reorder_finish(struct reorder *ro, int file) {
+    int rc;
+
+    rc = pthread_mutex_lock(&ro->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return REORDER_FAILURE;
+    }
+    ro->files[file].finished = 1;
+    rc = pthread_mutex_unlock(&ro->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+        return REORDER_FAILURE;
+    }
+
+    return REORDER_SUCCESS;
+}
+
+/* Desc:    Returns 1 if every result of a file has been released. */
+static int file_complete(struct reorder_file *f) {
+    return f->finished && f->next_seq == f->admitted;
+}
+
+/* Desc:    Picks the next file to release in ORDER_FILE mode.
+ *          Only a file whose next result has finished is picked,
+ *          preferring the one holding the most results.
+ * Return:  The file, -1 if none is ready yet, or nfiles if
+ *          every file is complete.
+ */
+static int pick_file(struct reorder *ro) {
+    struct reorder_file *f;
+    long held, best_held = -1;
+    int i, best = -1, remaining = 0;
+
+    for(i = 0; i < ro->nfiles; i++){
+        f = &ro->files[i];
+        if(file_complete(f))
+            continue;
+        remaining++;
+        if(f->slots[f->next_seq % ro->window] == NULL)
+            continue;
+        held = f->admitted - f->next_seq;
+        if(held > best_held){
+            best = i;
+            best_held = held;
+        }
+    }
+
+    return remaining ? best : ro->nfiles;
+}
+
+void *reorder_next(struct reorder *ro) {
+    struct reorder_file *f;
+    void *result = NULL;
+    int rc;
+
+    rc = pthread_mutex_lock(&ro->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return NULL;
+    }
+    while(1){
+        /* Move on once the current file has been released */
+        if(ro->current < 0 || (ro->current < ro->nfiles
+                    && file_complete(&ro->files[ro->current]))){
+            if(ro->mode == ORDER_INPUT){
+                ro->current++;
+            } else {
+                ro->current = pick_file(ro);
+                if(ro->current < 0)
+                    break;
+            }
+            continue;
+        }
+        if(ro->current >= ro->nfiles)
+            break;
+
+        f = &ro->files[ro->current];
+        result = f->slots[f->next_seq % ro->window];
+        if(result != NULL){
+            f->slots[f->next_seq % ro->window] = NULL;
+            f->next_seq++;
+            ro->buffered--;
+        }
+        break;
+    }
+    rc = pthread_mutex_unlock(&ro->mutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+        return NULL;
+    }
+
+    return result;
+}
+
+void reorder_cleanup(struct reorder *ro) {
+    int i;
+
+    if(ro->files != NULL){
+        for(i = 0; i < ro->nfiles; i++)
+            free(ro->files[i].slots);
+    }
+    free(ro->files);
+    ro->files = NULL;
+}
@@ -0,0 +1,82 @@
+/*
+ * File: reorder.h
+ * Description:
+ *      A bounded reorder buffer that releases results in input
+ *      order even though they finish in any order.
+ *
+ *      Readers number the names of each input file and must be
+ *      admitted before queueing a name. At most window results
+ *      are admitted but not yet released. The file being
+ *      released always has window / 2 of those slots to itself,
+ *      so it can make progress while the other files wait.
+ *
+ */
+
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <pthread.h>
+
+#define REORDER_FAILURE -1
+#define REORDER_SUCCESS 0
+#define REORDER_FULL -2
+
+#define ORDER_NONE 0    // Completion order. No reorder buffer.
+#define ORDER_INPUT 1   // Files in argument order, lines in file order.
+#define ORDER_FILE 2    // Each file contiguous, lines in file order.
+
+#define REORDER_WINDOW 4096
+
+struct reorder_file {
+    void **slots;       // Finished results, indexed by seq % window.
+    long next_seq;      // Sequence number of the next release.
+    long admitted;      // Sequence numbers handed out so far.
+    int finished;       // The reader is done with this file.
+};
+
+struct reorder {
+    int mode;
+    int nfiles;
+    long window;
+    long buffered;      // Admitted but not yet released, all files.
+    int current;        // The file being released. -1 before the first.
+    struct reorder_file *files;
+    pthread_mutex_t mutex;
+};
+
+/* Desc:    Initializes an empty reorder buffer.
+ * Args:    mode: ORDER_INPUT or ORDER_FILE.
+ *          nfiles: the number of input files.
+ *          window: the most results held at once. Must be
+ *          at least 2.
+ * Return:  REORDER_SUCCESS on success. REORDER_FAILURE on failure.
+ */
+int reorder_init(struct reorder *ro, int mode, int nfiles, long window);
+
+/* Desc:    Admits the next name of a file into the buffer.
+ * Return:  The name's sequence number within its file.
+ *          REORDER_FULL if the buffer has no room for this file
+ *          yet, in which case the caller should retry later.
+ *          REORDER_FAILURE on failure.
+ */
+long reorder_admit(struct reorder *ro, int file);
+
+/* Desc:    Stores the finished result of an admitted name.
+ * Return:  REORDER_SUCCESS on success. REORDER_FAILURE on failure.
+ */
+int reorder_put(struct reorder *ro, int file, long seq, void *result);
+
+/* Desc:    Marks a file as fully admitted. */
+int reorder_finish(struct reorder *ro, int file);
+
+/* Desc:    Releases the next result in output order.
+ *          Call until it returns NULL after every reorder_put
+ *          and reorder_finish.
+ * Return:  The result, or NULL if the next one has not finished.
+ */
+void *reorder_next(struct reorder *ro);
+
+/* Desc:    Frees the buffer. Unreleased results are not freed. */
+void reorder_cleanup(struct reorder *ro);
+
+#endif
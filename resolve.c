@@ -0,0 +1,322 @@
+/*
+ * File: resolve.c
+ * Description:
+ *      Forward and reverse lookups that follow CNAME chains hop
+ *      by hop, caching CNAME targets separately from answers.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include "resolve.h"
+
+/* Records with a TTL of 0 are still cached for this long so
+ * that the lookup which fetched them can walk the chain. */
+#define MIN_CACHE_TTL 1
+
+static const ns_type addr_types[] = {ns_t_a, ns_t_aaaa};
+static const ns_type ptr_types[] = {ns_t_ptr};
+
+int resolver_caches_init(struct resolver_caches *caches) {
+    if(cache_init(&caches->cname_cache, CACHE_BUCKETS) == CACHE_FAILURE)
+        return RESOLVE_FAILURE;
+    if(cache_init(&caches->addr_cache, CACHE_BUCKETS) == CACHE_FAILURE){
+        cache_cleanup(&caches->cname_cache);
+        return RESOLVE_FAILURE;
+    }
+    if(cache_init(&caches->ptr_cache, CACHE_BUCKETS) == CACHE_FAILURE){
+        cache_cleanup(&caches->cname_cache);
+        cache_cleanup(&caches->addr_cache);
+        return RESOLVE_FAILURE;
+    }
+    return RESOLVE_SUCCESS;
+}
+
+void resolver_caches_cleanup(struct resolver_caches *caches) {
+    cache_cleanup(&caches->cname_cache);
+    cache_cleanup(&caches->addr_cache);
+    cache_cleanup(&caches->ptr_cache);
+}
+
+/* Desc:    Returns the cache that holds answers of a type. The
+ *          types passed to chain_lookup together must share one.
+ */
+static cache *answer_cache(struct resolver_caches *caches, ns_type type) {
+    return type == ns_t_ptr ? &caches->ptr_cache : &caches->addr_cache;
+}
+
+/* Desc:    Strips a single trailing dot from a name so that
+ *          it matches the owner names in answers.
+ */
+static void strip_root(char *name) {
+    size_t len = strlen(name);
+
+    if(len > 1 && name[len-1] == '.')
+        name[len-1] = '\0';
+}
+
+/* Desc:    Sends one query and caches the records on the chain
+ *          of the queried name: the CNAMEs followed from it, and
+ *          the first record of the queried type owned by the end
+ *          of the chain. Other records in the answer are ignored,
+ *          so a server cannot plant answers for unrelated names.
+ * Args:    errfp: where errors are printed.
+ *          type: ns_t_a, ns_t_aaaa or ns_t_ptr.
+ * Return:  RESOLVE_SUCCESS if the server answered, even if the
+ *          answer holds no records of the requested type.
+ *          RESOLVE_NOT_FOUND if the name does not exist.
+ *          RESOLVE_FAILURE otherwise, in which case an error is
+ *          printed.
+ */
+static int resolve_query(FILE *errfp, res_state statp,
+        struct resolver_caches *caches, const char *name, ns_type type) {
+    unsigned char answer[NS_MAXMSG];
+    char owner[NS_MAXDNAME];    // The name the chain has reached.
+    char target[NS_MAXDNAME];
+    char value[NS_MAXDNAME];
+    unsigned long ttl;
+    ns_msg msg;
+    ns_rr rr;
+    int len, i, count, depth, found;
+
+    len = res_nquery(statp, name, ns_c_in, type, answer, sizeof(answer));
+    if(len < 0){
+        /* The name exists but has no records of this type */
+        if(statp->res_h_errno == NO_DATA)
+            return RESOLVE_SUCCESS;
+        if(statp->res_h_errno == HOST_NOT_FOUND)
+            return RESOLVE_NOT_FOUND;
+        fprintf(errfp, "Error looking up \"%s\": %s\n",
+                name, hstrerror(statp->res_h_errno));
+        return RESOLVE_FAILURE;
+    }
+    if(ns_initparse(answer, len, &msg) < 0){
+        fprintf(errfp, "Error parsing the answer for \"%s\"\n", name);
+        return RESOLVE_FAILURE;
+    }
+    count = ns_msg_count(msg, ns_s_an);
+
+    strncpy(owner, name, sizeof(owner));
+    owner[sizeof(owner)-1] = '\0';
+    strip_root(owner);
+
+    /* Follow the CNAMEs from the queried name. Servers list them
+     * in order, but a pass per hop does not rely on it. */
+    for(depth = 0, found = 1; found && depth < MAX_CNAME_DEPTH; depth++){
+        found = 0;
+        for(i = 0; i < count && !found; i++){
+            if(ns_parserr(&msg, ns_s_an, i, &rr) < 0){
+                fprintf(errfp, "Error parsing the answer for \"%s\"\n", name);
+                return RESOLVE_FAILURE;
+            }
+            if(ns_rr_type(rr) != ns_t_cname
+                    || strcasecmp(ns_rr_name(rr), owner) != 0)
+                continue;
+            if(ns_name_uncompress(ns_msg_base(msg), ns_msg_end(msg),
+                        ns_rr_rdata(rr), target, sizeof(target)) < 0)
+                continue;
+            ttl = ns_rr_ttl(rr);
+            if(ttl < MIN_CACHE_TTL)
+                ttl = MIN_CACHE_TTL;
+            cache_put(&caches->cname_cache, owner, target, ttl);
+            strcpy(owner, target);
+            found = 1;
+        }
+    }
+
+    /* Keep the first answer for the end of the chain */
+    for(i = 0; i < count; i++){
+        if(ns_parserr(&msg, ns_s_an, i, &rr) < 0){
+            fprintf(errfp, "Error parsing the answer for \"%s\"\n", name);
+            return RESOLVE_FAILURE;
+        }
+        if(ns_rr_type(rr) != type || strcasecmp(ns_rr_name(rr), owner) != 0)
+            continue;
+        if(type == ns_t_a && ns_rr_rdlen(rr) == NS_INADDRSZ){
+            inet_ntop(AF_INET, ns_rr_rdata(rr), value, sizeof(value));
+        } else if(type == ns_t_aaaa && ns_rr_rdlen(rr) == NS_IN6ADDRSZ){
+            inet_ntop(AF_INET6, ns_rr_rdata(rr), value, sizeof(value));
+        } else if(type == ns_t_ptr){
+            if(ns_name_uncompress(ns_msg_base(msg), ns_msg_end(msg),
+                        ns_rr_rdata(rr), value, sizeof(value)) < 0)
+                continue;
+        } else {
+            continue;
+        }
+        ttl = ns_rr_ttl(rr);
+        if(ttl < MIN_CACHE_TTL)
+            ttl = MIN_CACHE_TTL;
+        cache_put(answer_cache(caches, type), owner, value, ttl);
+        break;
+    }
+
+    return RESOLVE_SUCCESS;
+}
+
+/* Desc:    Follows CNAMEs from name until a name has an answer
+ *          of one of the given types, trying the types in order.
+ *          The args are as in cname_lookup.
+ */
+static int chain_lookup(FILE *errfp, res_state statp,
+        struct resolver_caches *caches, const ns_type *types, int ntypes, const char *hostname,
+        char *chain, int chain_size, char *answer, int answer_size) {
+    char current[NS_MAXDNAME];
+    char target[NS_MAXDNAME];
+    int depth = 0;
+    int tried = 0;              // Types queried for the current name.
+    int rc;
+
+    strncpy(current, hostname, sizeof(current));
+    current[sizeof(current)-1] = '\0';
+    strip_root(current);
+    chain[0] = '\0';
+
+    while(1){
+        /* Done once the current name has an answer */
+        rc = cache_get(answer_cache(caches, types[0]), current,
+                answer, answer_size);
+        if(rc != CACHE_MISS)
+            return rc == CACHE_SUCCESS ? RESOLVE_SUCCESS : RESOLVE_FAILURE;
+
+        /* Follow the next hop if the current name is an alias */
+        rc = cache_get(&caches->cname_cache, current, target, sizeof(target));
+        if(rc == CACHE_FAILURE)
+            return RESOLVE_FAILURE;
+        if(rc == CACHE_SUCCESS){
+            if(++depth > MAX_CNAME_DEPTH){
+                fprintf(errfp, "Error looking up \"%s\": CNAME chain "
+                        "longer than %d\n", hostname, MAX_CNAME_DEPTH);
+                return RESOLVE_FAILURE;
+            }
+            if(strlen(chain) + strlen(CNAME_SEPARATOR) + strlen(target)
+                    >= (size_t)chain_size){
+                fprintf(errfp, "Error looking up \"%s\": CNAME chain "
+                        "too long\n", hostname);
+                return RESOLVE_FAILURE;
+            }
+            if(chain[0] != '\0')
+                strcat(chain, CNAME_SEPARATOR);
+            strcat(chain, target);
+            strcpy(current, target);
+            tried = 0;
+            continue;
+        }
+
+        /* Nothing cached for the current name, so ask for it.
+         * The answer usually carries the rest of the chain. */
+        if(tried == ntypes){
+            fprintf(errfp, "Error looking up \"%s\": No answer for "
+                    "\"%s\"\n", hostname, current);
+            return RESOLVE_FAILURE;
+        }
+        rc = resolve_query(errfp, statp, caches, current, types[tried++]);
+        if(rc == RESOLVE_NOT_FOUND){
+            /* Only the name itself may be left to the caller */
+            if(depth == 0)
+                return RESOLVE_NOT_FOUND;
+            fprintf(errfp, "Error looking up \"%s\": \"%s\" does not "
+                    "exist\n", hostname, current);
+            return RESOLVE_FAILURE;
+        }
+        if(rc != RESOLVE_SUCCESS)
+            return RESOLVE_FAILURE;
+    }
+}
+
+int cname_lookup(FILE *errfp, res_state statp,
+        struct resolver_caches *caches, const char *hostname,
+        char *chain, int chain_size, char *ip, int ip_size) {
+    return chain_lookup(errfp, statp, caches, addr_types, 2, hostname,
+            chain, chain_size, ip, ip_size);
+}
+
+int ptr_lookup(FILE *errfp, res_state statp,
+        struct resolver_caches *caches, const char *revname,
+        char *chain, int chain_size, char *name, int name_size) {
+    return chain_lookup(errfp, statp, caches, ptr_types, 1, revname,
+            chain, chain_size, name, name_size);
+}
+
+/* Desc:    Scans the hosts file for a line matching key. If
+ *          by_addr is set, key is an address in binary form of
+ *          length keylen, otherwise it is a host name.
+ * Args:    name: buffer of size name_size that receives the first
+ *          host name of the matching line, or NULL.
+ * Return:  1 if a line matched, 0 if none did.
+ */
+static int hosts_find(int by_addr, const void *key, int keylen,
+        char *name, int name_size) {
+    FILE *fp;
+    char *line = NULL;
+    size_t line_cap = 0;
+    char *tok, *save, *first;
+    unsigned char addr[sizeof(struct in6_addr)];
+    int found = 0;
+
+    fp = fopen(HOSTS_FILE, "r");
+    if(fp == NULL)
+        return 0;
+
+    while(!found && getline(&line, &line_cap, fp) >= 0){
+        line[strcspn(line, "#")] = '\0';
+        /* Each line is an address followed by its names */
+        tok = strtok_r(line, " \t\n", &save);
+        if(tok == NULL)
+            continue;
+        if(by_addr){
+            if(inet_pton(keylen == sizeof(struct in_addr) ? AF_INET : AF_INET6,
+                        tok, addr) != 1
+                    || memcmp(addr, key, keylen) != 0)
+                continue;
+        }
+        first = strtok_r(NULL, " \t\n", &save);
+        for(tok = first; tok != NULL && !found;
+                tok = strtok_r(NULL, " \t\n", &save))
+            found = by_addr || strcasecmp(tok, key) == 0;
+        if(found && name != NULL){
+            strncpy(name, first, name_size);
+            name[name_size-1] = '\0';
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return found;
+}
+
+int hosts_has_name(const char *hostname) {
+    char name[NS_MAXDNAME];
+
+    strncpy(name, hostname, sizeof(name));
+    name[sizeof(name)-1] = '\0';
+    strip_root(name);
+
+    return hosts_find(0, name, 0, NULL, 0);
+}
+
+int hosts_name_lookup(FILE *errfp, const char *addr,
+        char *name, int name_size) {
+    unsigned char bin[sizeof(struct in6_addr)];
+    int len;
+
+    if(inet_pton(AF_INET, addr, bin) == 1)
+        len = sizeof(struct in_addr);
+    else if(inet_pton(AF_INET6, addr, bin) == 1)
+        len = sizeof(struct in6_addr);
+    else {
+        fprintf(errfp, "Error looking up \"%s\": Not an address\n", addr);
+        return RESOLVE_FAILURE;
+    }
+
+    if(!hosts_find(1, bin, len, name, name_size)){
+        fprintf(errfp, "Error looking up \"%s\": No PTR record\n", addr);
+        return RESOLVE_FAILURE;
+    }
+
+    return RESOLVE_SUCCESS;
+}
@@ -0,0 +1,105 @@
+/*
+ * File: resolve.h
+ * Description:
+ *      Forward and reverse lookups that follow CNAME chains hop
+ *      by hop, caching CNAME targets separately from answers.
+ *
+ */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <stdio.h>
+#include <netinet/in.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+#include "cache.h"
+
+#define RESOLVE_FAILURE -1
+#define RESOLVE_SUCCESS 0
+#define RESOLVE_NOT_FOUND -2    // The name does not exist in the DNS.
+
+#define HOSTS_FILE "/etc/hosts"
+
+#define MAX_CNAME_DEPTH 16
+#define CNAME_SEPARATOR " -> "
+#define MAX_CHAIN_LENGTH (MAX_CNAME_DEPTH * (NS_MAXDNAME + 4))
+
+/* The caches shared by every resolver thread. A name that
+ * is an alias lives in cname_cache and maps to its target.
+ * A name that has addresses lives in addr_cache and maps to
+ * the first one. A reverse name with a PTR record lives in
+ * ptr_cache and maps to the first host name. All of them
+ * honour the TTL of the record. */
+struct resolver_caches {
+    cache cname_cache;
+    cache addr_cache;
+    cache ptr_cache;
+};
+
+/* Desc:    Initializes the caches.
+ * Return:  RESOLVE_SUCCESS on success. RESOLVE_FAILURE on failure.
+ */
+int resolver_caches_init(struct resolver_caches *caches);
+
+/* Desc:    Frees the caches. */
+void resolver_caches_cleanup(struct resolver_caches *caches);
+
+/* Desc:    Resolves hostname to its first address, following
+ *          CNAMEs one hop at a time. Every hop is served from
+ *          the caches when possible, so names that alias the
+ *          same target only query for that target once per TTL,
+ *          though threads that miss on a target at the same time
+ *          each query for it. The A record is tried first, then
+ *          AAAA. Only the DNS is asked, so /etc/hosts and search
+ *          domains are left to the caller.
+ * Args:    errfp: where errors are printed.
+ *          statp: the calling thread's resolver state.
+ *          caches: the shared caches.
+ *          hostname: the name to resolve.
+ *          chain: buffer of size chain_size that receives the
+ *          CNAME targets in order, separated by CNAME_SEPARATOR.
+ *          It is empty if hostname is not an alias.
+ *          ip: buffer of size ip_size that receives the address.
+ * Return:  RESOLVE_SUCCESS on success. RESOLVE_NOT_FOUND if
+ *          hostname itself does not exist in the DNS, in which
+ *          case nothing is printed. RESOLVE_FAILURE on failure,
+ *          in which case an error has been printed and chain
+ *          holds the hops followed before the failure.
+ */
+int cname_lookup(FILE *errfp, res_state statp,
+        struct resolver_caches *caches, const char *hostname,
+        char *chain, int chain_size, char *ip, int ip_size);
+
+/* Desc:    Resolves a reverse name, such as 4.3.2.1.in-addr.arpa,
+ *          to the first host name of its PTR record. CNAMEs are
+ *          followed and cached as in cname_lookup, which covers
+ *          classless delegation (RFC 2317).
+ * Args:    name: buffer of size name_size that receives the
+ *          host name. The other args are as in cname_lookup.
+ * Return:  As in cname_lookup.
+ */
+int ptr_lookup(FILE *errfp, res_state statp,
+        struct resolver_caches *caches, const char *revname,
+        char *chain, int chain_size, char *name, int name_size);
+
+/* Desc:    Returns 1 if hostname is listed in the hosts file,
+ *          0 otherwise. Only the file is read.
+ */
+int hosts_has_name(const char *hostname);
+
+/* Desc:    Resolves an address to the first host name listed for
+ *          it in the hosts file. This covers addresses the DNS has
+ *          no PTR record for, such as 127.0.0.1, without sending a
+ *          second query for them.
+ * Args:    errfp: where errors are printed.
+ *          addr: the address as text.
+ *          name: buffer of size name_size that receives the name.
+ * Return:  RESOLVE_SUCCESS on success. RESOLVE_FAILURE on failure,
+ *          in which case an error has been printed.
+ */
+int hosts_name_lookup(FILE *errfp, const char *addr,
+        char *name, int name_size);
+
+#endif
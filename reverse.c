@@ -0,0 +1,141 @@
+/*
+ * File: reverse.c
+ * Description:
+ *      Parsing of addresses and CIDR ranges for reverse (PTR)
+ *      lookups.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+
+#include "reverse.h"
+
+static const char *range_errors[] = {
+    "ok",
+    "blank",
+    "invalid-address",
+    "range-too-large",
+};
+
+const char *range_strerror(int code) {
+    if(code < 0 || code >= (int)(sizeof(range_errors) / sizeof(range_errors[0])))
+        return "unknown";
+    return range_errors[code];
+}
+
+/* Desc:    Returns the address length in bytes of a family. */
+static int addr_len(int family) {
+    return family == AF_INET ? 4 : 16;
+}
+
+int range_parse(const char *text, struct addr_range *r) {
+    char buf[INET6_ADDRSTRLEN + 5];
+    const char *start = text, *end;
+    char *slash, *prefix_end;
+    long prefix;
+    int bits, i;
+
+    /* Trim surrounding whitespace */
+    while(isspace((unsigned char)*start))
+        start++;
+    end = start + strlen(start);
+    while(end > start && isspace((unsigned char)end[-1]))
+        end--;
+    if(end == start)
+        return RANGE_BLANK;
+    if(end - start >= (long)sizeof(buf))
+        return RANGE_INVALID;
+    memcpy(buf, start, end - start);
+    buf[end - start] = '\0';
+
+    slash = strchr(buf, '/');
+    if(slash != NULL)
+        *slash = '\0';
+
+    memset(r->next, 0, sizeof(r->next));
+    if(inet_pton(AF_INET, buf, r->next) == 1)
+        r->family = AF_INET;
+    else if(inet_pton(AF_INET6, buf, r->next) == 1)
+        r->family = AF_INET6;
+    else
+        return RANGE_INVALID;
+    bits = addr_len(r->family) * 8;
+
+    prefix = bits;
+    if(slash != NULL){
+        prefix = strtol(slash + 1, &prefix_end, 10);
+        if(prefix_end == slash + 1 || *prefix_end != '\0'
+                || prefix < 0 || prefix > bits)
+            return RANGE_INVALID;
+    }
+    if(r->family == AF_INET6 && prefix < MIN_IPV6_PREFIX)
+        return RANGE_TOO_LARGE;
+
+    /* Clear the host bits so the walk starts at the network */
+    for(i = 0; i < bits; i++){
+        if(i >= prefix)
+            r->next[i / 8] &= ~(0x80 >> (i % 8));
+    }
+    r->remaining = 1L << (bits - prefix);
+
+    return RANGE_OK;
+}
+
+void range_skip(struct addr_range *r, long n) {
+    unsigned long carry;
+    int i;
+
+    if(n >= r->remaining){
+        r->remaining = 0;
+        return;
+    }
+    r->remaining -= n;
+
+    /* Add n to the big endian address */
+    carry = n;
+    for(i = addr_len(r->family) - 1; i >= 0 && carry != 0; i--){
+        carry += r->next[i];
+        r->next[i] = carry & 0xff;
+        carry >>= 8;
+    }
+}
+
+int range_next(struct addr_range *r, char *addr, int size) {
+    if(r->remaining <= 0)
+        return 0;
+    if(inet_ntop(r->family, r->next, addr, size) == NULL)
+        return 0;
+    range_skip(r, 1);
+    return 1;
+}
+
+int reverse_name(const char *addr, char *name, int size) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char bytes[16];
+    int i, len = 0;
+
+    if(size < MAX_REVERSE_LENGTH)
+        return 1;
+
+    if(inet_pton(AF_INET, addr, bytes) == 1){
+        snprintf(name, size, "%u.%u.%u.%u.in-addr.arpa",
+                bytes[3], bytes[2], bytes[1], bytes[0]);
+        return 0;
+    }
+    if(inet_pton(AF_INET6, addr, bytes) == 1){
+        for(i = 15; i >= 0; i--){
+            name[len++] = hex[bytes[i] & 0x0f];
+            name[len++] = '.';
+            name[len++] = hex[bytes[i] >> 4];
+            name[len++] = '.';
+        }
+        strcpy(name + len, "ip6.arpa");
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,58 @@
+/*
+ * File: reverse.h
+ * Description:
+ *      Parsing of addresses and CIDR ranges for reverse (PTR)
+ *      lookups. Ranges are walked one address at a time and
+ *      never expanded in memory.
+ *
+ */
+
+#ifndef REVERSE_H
+#define REVERSE_H
+
+#define RANGE_OK 0
+#define RANGE_BLANK 1           // Nothing but whitespace.
+#define RANGE_INVALID 2         // Not an address or CIDR range.
+#define RANGE_TOO_LARGE 3       // An IPv6 prefix under MIN_IPV6_PREFIX.
+
+/* Keeps an IPv6 range to as many addresses as all of IPv4 */
+#define MIN_IPV6_PREFIX 96
+
+/* Long enough for "f.f.f. ... .ip6.arpa" */
+#define MAX_REVERSE_LENGTH 74
+
+struct addr_range {
+    int family;                 // AF_INET or AF_INET6.
+    unsigned char next[16];     // The next address, in network order.
+    long remaining;             // Addresses left, including next.
+};
+
+/* Desc:    Parses an address or CIDR range, ignoring surrounding
+ *          whitespace. A single address is a range of one. Host
+ *          bits set in a range's address are cleared.
+ * Args:    text: the line, ending with \0.
+ *          r: receives the range.
+ * Return:  RANGE_OK on success, otherwise a RANGE_* code.
+ */
+int range_parse(const char *text, struct addr_range *r);
+
+/* Desc:    Skips the next n addresses of a range. */
+void range_skip(struct addr_range *r, long n);
+
+/* Desc:    Takes the next address of a range.
+ * Args:    addr: buffer of size size for the address as text.
+ * Return:  1 if an address was taken, 0 if the range is used up.
+ */
+int range_next(struct addr_range *r, char *addr, int size);
+
+/* Desc:    Builds the in-addr.arpa or ip6.arpa name of an address.
+ * Args:    addr: the address as text.
+ *          name: buffer of size size, at least MAX_REVERSE_LENGTH.
+ * Return:  0 on success. 1 if addr is not an address.
+ */
+int reverse_name(const char *addr, char *name, int size);
+
+/* Desc:    Returns a short string naming a RANGE_* code. */
+const char *range_strerror(int code);
+
+#endif
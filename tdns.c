@@ -9,13 +9,22 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
 
 #include "queue.h"
 #include "util.h"
+#include "resolve.h"
+#include "checkpoint.h"
+#include "reorder.h"
+#include "normalize.h"
+#include "reverse.h"
 #include "tdns.h"
+#include "daemon.h"
 
 int rsleep(pthread_mutex_t *randmutex){
     int rsec, rc;
@@ -36,11 +45,11 @@ int rsleep(pthread_mutex_t *randmutex){
 
 /* Desc:    A thread safe wrapper for pushing to the queue.
  *          The queue is globally defined with name url_q.
- * Args:    item: a string ending with \0
+ * Args:    item: a heap allocated url_item.
  * Return:  0 on success. 1 on failure.
  */
 int ts_queue_push(queue* url_q, pthread_mutex_t *qmutex,
-        pthread_mutex_t *randmutex, char item[]) {
+        pthread_mutex_t *randmutex, struct url_item *item) {
     int rc;
 
     while(1){
@@ -79,11 +88,11 @@ int ts_queue_push(queue* url_q, pthread_mutex_t *qmutex,
  *          1) The call has failed.
  *          2) The queue is empty and the readers are done.
  */
-char *ts_queue_pop(queue *url_q, pthread_mutex_t *qmutex,
+struct url_item *ts_queue_pop(queue *url_q, pthread_mutex_t *qmutex,
         pthread_mutex_t *randmutex,
-        pthread_mutex_t *status_mutex,
+        pthread_mutex_t *status_mutex, pthread_cond_t *status_cond,
         int *reader_stat){
-    char *itemp;
+    struct url_item *itemp;
     int rc;
 
     /* Check if the queue is empty. */
@@ -111,6 +120,10 @@ char *ts_queue_pop(queue *url_q, pthread_mutex_t *qmutex,
                 return NULL;
             }
             rc = pthread_mutex_unlock(qmutex);
+            /* Without jobs nothing can be queued, so sleep until
+             * one starts */
+            while(rc == 0 && (*reader_stat) == IDLE)
+                rc = pthread_cond_wait(status_cond, status_mutex);
             rc = pthread_mutex_unlock(status_mutex) || rc;
             if(rc != 0) {
                 fprintf(stderr, "There was an error unlocking the mutex.\n");
@@ -153,6 +166,213 @@ int removenl(int max_len, char *str) {
     return 0;
 }
 
+char *trim(char *str) {
+    char *end;
+
+    while(isspace((unsigned char)*str))
+        str++;
+    end = str + strlen(str);
+    while(end > str && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+
+    return str;
+}
+
+int job_init(struct job *job, FILE *outputfp) {
+    memset(job, 0, sizeof(struct job));
+    job->outputfp = outputfp;
+    job->errfp = stderr;
+    if(pthread_mutex_init(&job->outmutex, NULL) != 0){
+        fprintf(stderr, "There was an error initializing the mutex.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+void job_cleanup(struct job *job) {
+    pthread_mutex_destroy(&job->outmutex);
+}
+
+int job_pending_add(struct job *job, long n) {
+    int rc;
+
+    rc = pthread_mutex_lock(&job->outmutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return 1;
+    }
+    job->pending += n;
+    rc = pthread_mutex_unlock(&job->outmutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int run_job(struct consumer_args *cargs, struct job *job,
+        FILE **inputfps, int inputfc) {
+    pthread_t rthreads[inputfc];
+    struct reader_args rargs[inputfc];
+    long pending;
+    int i, rc, started, failed = 0;
+
+    /* Spawn reader threads */
+    for(started = 0; started < inputfc; started++) {
+        i = started;
+        /* Init reader arg struct */
+        rargs[i].inputfp = inputfps[i];
+        rargs[i].url_q = cargs->url_q;
+        rargs[i].qmutex = cargs->qmutex;
+        rargs[i].randmutex = cargs->randmutex;
+        rargs[i].file = i;
+        rargs[i].job = job;
+        memset(&rargs[i].resume, 0, sizeof(struct file_progress));
+        if(job->resumed){
+            rc = checkpoint_progress_copy(job->ckpt, i, &rargs[i].resume);
+            if(rc == CHECKPOINT_FAILURE){
+                failed = 1;
+                break;
+            }
+        }
+        rc = pthread_create(rthreads + i, NULL, reader, rargs + i);
+        if(rc){
+            fprintf(stderr, "ERROR: Return code from pthread_create() is %d\n", rc);
+            progress_cleanup(&rargs[i].resume);
+            failed = 1;
+            break;
+        }
+    }
+
+    /* Join the reader threads */
+    for(i = 0; i < started; i++){
+        rc = pthread_join(rthreads[i], NULL);
+        if(rc != 0){
+            fprintf(stderr, "There was an error joining the threads.\n");
+            return 1;
+        }
+        progress_cleanup(&rargs[i].resume);
+    }
+
+    /* The readers are finished. Wait for the writers to get
+     * through the names they queued. */
+    while(1){
+        rc = pthread_mutex_lock(&job->outmutex);
+        if(rc != 0){
+            fprintf(stderr, "There was an error locking the mutex.\n");
+            return 1;
+        }
+        pending = job->pending;
+        rc = pthread_mutex_unlock(&job->outmutex);
+        if(rc != 0){
+            fprintf(stderr, "There was an error unlocking the mutex.\n");
+            return 1;
+        }
+        if(pending == 0)
+            break;
+        rsleep(cargs->randmutex);
+    }
+
+    /* Write anything the reorder buffer still holds. Normally
+     * this is nothing, unless a reader stopped on an error. */
+    if(job->reorder != NULL){
+        for(i = 0; i < inputfc; i++)
+            reorder_finish(job->reorder, i);
+        write_ready(job);
+    }
+
+    return failed;
+}
+
+void job_cancel(struct job *job) {
+    if(pthread_mutex_lock(&job->outmutex) != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return;
+    }
+    job->cancelled = 1;
+    if(pthread_mutex_unlock(&job->outmutex) != 0)
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+}
+
+int job_cancelled(struct job *job) {
+    int cancelled;
+
+    if(pthread_mutex_lock(&job->outmutex) != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return 0;
+    }
+    cancelled = job->cancelled;
+    if(pthread_mutex_unlock(&job->outmutex) != 0)
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+
+    return cancelled;
+}
+
+int queue_name(struct reader_args *args, const char *name,
+        const struct span *span, const char *reason) {
+    struct job *job = args->job;
+    struct reorder *ro = job->reorder;
+    struct url_item *item;
+    char line[MAX_RESULT_LENGTH];
+    long seq = 0;
+    int rc;
+
+    /* Stop reading once the job is cancelled */
+    if(job_cancelled(job))
+        return 1;
+    /* Wait for room in the reorder buffer. This is what
+     * stops a slow lookup from letting the buffer grow. */
+    if(ro != NULL){
+        while((seq = reorder_admit(ro, args->file)) == REORDER_FULL){
+            if(job_cancelled(job))
+                return 1;
+            rsleep(args->randmutex);
+        }
+        if(seq == REORDER_FAILURE)
+            return 1;
+    }
+    /* Copy the item to the heap */
+    item = calloc(1, sizeof(struct url_item));
+    if(item == NULL){
+        fprintf(stderr, "Error mallocing.\n");
+        return 1;
+    }
+    item->name = strndup(name, MAX_NAME_LENGTH - 1);
+    if(item->name == NULL){
+        fprintf(stderr, "Error copying string to the heap.\n");
+        free(item);
+        return 1;
+    }
+    item->job = job;
+    item->file = args->file;
+    item->span = *span;
+    item->seq = seq;
+    if(job_pending_add(job, 1) != 0){
+        free_item(item);
+        return 1;
+    }
+    /* Write rejected names straight to the output */
+    if(reason != NULL){
+        fprintf(job->errfp, "Rejected \"%s\": %s\n", item->name, reason);
+        format_result(line, MAX_RESULT_LENGTH, job->follow_cname,
+                item->name, "", "");
+        return submit_result(job, item, line);
+    }
+    /* Push a ptr to the item onto the q */
+    rc = ts_queue_push(args->url_q, args->qmutex, args->randmutex, item);
+    if(rc == 1){
+        fprintf(stderr, "There was an error pushing to the queue.\n");
+        free_item(item);
+        job_pending_add(job, -1);
+        return 1;
+    }
+
+    return 0;
+}
+
 void *reader(void *arg) {
 
     struct reader_args *args = arg;
@@ -160,139 +380,535 @@ void *reader(void *arg) {
     queue *url_q = args->url_q;
     pthread_mutex_t *qmutex = args->qmutex;
     pthread_mutex_t *randmutex = args->randmutex;
+    struct file_progress *resume = &args->resume;
     char linebuf[MAX_NAME_LENGTH];
-    char *heap_str;
-    int rc;
+    char restbuf[MAX_NAME_LENGTH];
+    char name[MAX_NAME_LENGTH];
+    struct url_item *item;
+    struct addr_range range;
+    struct span span;
+    struct input_pos start = resume->watermark; // Start of the next span.
+    long offset = start.offset;         // Offset of the next line.
+    long line_start, sub;
+    int rc, code, stop = 0;
+
+    /* Skip the part of the file a previous run finished */
+    if(offset > 0 && fseek(inputfp, offset, SEEK_SET) != 0){
+        perror("Error seeking in an input file");
+        return NULL;
+    }
 
     /* Read a line from the file and push it to the q */
-    while(fgets(linebuf, MAX_NAME_LENGTH, inputfp) != NULL){
+    while(!stop && fgets(linebuf, MAX_NAME_LENGTH, inputfp) != NULL){
+        line_start = offset;
+        offset += strlen(linebuf);
+        /* A line too long for the buffer is rejected as a whole */
+        code = NAME_OK;
+        if(strchr(linebuf, '\n') == NULL){
+            while(fgets(restbuf, MAX_NAME_LENGTH, inputfp) != NULL){
+                code = NAME_TOO_LONG;
+                offset += strlen(restbuf);
+                if(strchr(restbuf, '\n') != NULL)
+                    break;
+            }
+        }
         /* Remove any newlines from the end of the URL */
         removenl(MAX_NAME_LENGTH, linebuf);
+
+        if(args->job->reverse){
+            /* Each address of a range gets its own span, so the
+             * range can be resumed partway through */
+            if(code == NAME_OK)
+                code = range_parse(linebuf, &range);
+            else
+                code = RANGE_INVALID;
+            if(code == RANGE_BLANK)
+                continue;
+            if(code != RANGE_OK){
+                span.start = start;
+                span.end.offset = offset;
+                span.end.sub = 0;
+                start = span.end;
+                if(!progress_is_done(resume, span.start))
+                    stop = queue_name(args, trim(linebuf), &span,
+                            range_strerror(code));
+                continue;
+            }
+            sub = 0;
+            if(line_start == start.offset && start.sub > 0){
+                range_skip(&range, start.sub);
+                sub = start.sub;
+            }
+            while(!stop && range_next(&range, name, MAX_NAME_LENGTH)){
+                span.start = start;
+                span.end.offset = range.remaining > 0 ? line_start : offset;
+                span.end.sub = range.remaining > 0 ? ++sub : 0;
+                start = span.end;
+                if(!progress_is_done(resume, span.start))
+                    stop = queue_name(args, name, &span, NULL);
+            }
+            continue;
+        }
+
+        /* Lowercase and check the name. Junk is rejected here
+         * so it never takes up a resolver. */
+        if(code == NAME_OK)
+            code = normalize_name(linebuf, name, MAX_NAME_LENGTH,
+                    args->job->idn);
         /* Skip blank lines */
-        if(linebuf[0] == '\0')
+        if(code == NAME_BLANK)
             continue;
-        /* Copy the string to the heap */
-        heap_str = strndup(linebuf, MAX_NAME_LENGTH - 1);
-        if(heap_str == NULL){
-            fprintf(stderr, "Error copying string to the heap.\n");
+        span.start = start;
+        span.end.offset = offset;
+        span.end.sub = 0;
+        start = span.end;
+        /* Skip names a previous run finished */
+        if(progress_is_done(resume, span.start))
+            continue;
+        if(code == NAME_OK)
+            stop = queue_name(args, name, &span, NULL);
+        else
+            stop = queue_name(args, trim(linebuf), &span,
+                    normalize_strerror(code));
+    }
+
+    /* Tell the writers the file is done so the reorder
+     * buffer can move on to the next one. */
+    if(args->job->reorder != NULL){
+        item = calloc(1, sizeof(struct url_item));
+        if(item == NULL){
+            fprintf(stderr, "Error mallocing.\n");
+            return NULL;
+        }
+        item->job = args->job;
+        item->file = args->file;
+        if(job_pending_add(args->job, 1) != 0){
+            free(item);
             return NULL;
         }
-        /* Push a ptr to the string onto the q */
-        rc = ts_queue_push(url_q, qmutex, randmutex, heap_str);
+        rc = ts_queue_push(url_q, qmutex, randmutex, item);
         if(rc == 1){
             fprintf(stderr, "There was an error pushing to the queue.\n");
-            return NULL;
+            free(item);
+            job_pending_add(args->job, -1);
         }
     }
 
     return NULL;
 }
 
+void free_item(struct url_item *item) {
+    free(item->name);
+    free(item->result);
+    free(item);
+}
+
+int write_result(struct job *job, struct url_item *item,
+        const char *line) {
+    int rc, written;
+
+    written = fprintf(job->outputfp, "%s", line);
+    if(written < 0)
+        return 1;
+    /* Record the progress while the output is still locked */
+    if(job->ckpt != NULL){
+        rc = checkpoint_done(job->ckpt, item->file, &item->span, written);
+        if(rc == CHECKPOINT_FAILURE){
+            fprintf(stderr, "There was an error writing a checkpoint.\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void format_result(char *line, int size, int follow_cname,
+        const char *name, const char *ip, const char *chain) {
+    if(follow_cname)
+        snprintf(line, size, "%s, %s, %s\n", name, ip, chain);
+    else
+        snprintf(line, size, "%s, %s\n", name, ip);
+}
+
+int submit_result(struct job *job, struct url_item *item,
+        const char *line) {
+    struct reorder *ro = job->reorder;
+    int rc;
+
+    rc = pthread_mutex_lock(&job->outmutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error locking the mutex.\n");
+        return 1;
+    }
+    if(ro == NULL){
+        if(line != NULL && !job->cancelled)
+            write_result(job, item, line);
+        free_item(item);
+    } else {
+        /* Hand the result to the reorder buffer, then write
+         * whatever is now next in order. A cancelled item goes
+         * in without a result, so it is skipped when released. */
+        if(line == NULL){
+            reorder_finish(ro, item->file);
+            free_item(item);
+        } else if(job->cancelled){
+            reorder_put(ro, item->file, item->seq, item);
+        } else {
+            item->result = strdup(line);
+            if(item->result == NULL)
+                fprintf(stderr, "Error copying string to the heap.\n");
+            reorder_put(ro, item->file, item->seq, item);
+        }
+        write_ready(job);
+    }
+    job->pending--;
+    rc = pthread_mutex_unlock(&job->outmutex);
+    if(rc != 0){
+        fprintf(stderr, "There was an error unlocking the mutex.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int write_ready(struct job *job) {
+    struct url_item *item;
+    int rc = 0;
+
+    while((item = reorder_next(job->reorder)) != NULL){
+        if(item->result != NULL && !job->cancelled)
+            rc = write_result(job, item, item->result) || rc;
+        free_item(item);
+    }
+
+    return rc;
+}
+
 void *writer(void *arg) {
     struct consumer_args *args = arg;
+    struct url_item *item;
+    struct job *job;
     char *str;
     char ip_str[MAX_IP_LENGTH];
+    char host[MAX_NAME_LENGTH];
+    char revname[MAX_REVERSE_LENGTH];
+    char chain[MAX_CHAIN_LENGTH];
+    char line[MAX_RESULT_LENGTH];
+    struct __res_state res;
     int rc;
-    FILE *outputfp = args->outputfp;
     queue *url_q = args->url_q;
     int *reader_stat = args->reader_stat;
     pthread_mutex_t *qmutex = args->qmutex;
     pthread_mutex_t *status_mutex = args->status_mutex;
-    pthread_mutex_t *outmutex = args->outmutex;
+    pthread_cond_t *status_cond = args->status_cond;
     pthread_mutex_t *randmutex = args->randmutex;
+    int follow_cname, reverse;
+
+    /* Each thread needs its own resolver state */
+    if(args->caches != NULL){
+        memset(&res, 0, sizeof(res));
+        if(res_ninit(&res) != 0){
+            fprintf(stderr, "There was an error initializing the resolver.\n");
+            return NULL;
+        }
+        /* Keep the upstream socket open between queries */
+        res.options |= RES_STAYOPEN;
+    }
 
     while(1){
-        str = ts_queue_pop(url_q, qmutex, randmutex,
-                status_mutex, reader_stat);
+        item = ts_queue_pop(url_q, qmutex, randmutex,
+                status_mutex, status_cond, reader_stat);
         /* If a NULL ptr is returned, either:
          * 1) An error occured.
          * 2) The queue is empty and the readers are done. */
-        if(str == NULL)
+        if(item == NULL)
             break;
-        rc = dnslookup(str, ip_str, MAX_IP_LENGTH);
-        if(rc == UTIL_FAILURE){
-            /* dnslookup prints an error, so no need to print
-             * one here.
-             * Empty ip_str because it probably contains junk */
-            ip_str[0] = '\0';
+        str = item->name;
+        job = item->job;
+        follow_cname = job->follow_cname;
+        reverse = job->reverse;
+        /* An item without a name marks the end of an input file.
+         * The names of a cancelled job are only counted off. */
+        if(str != NULL && job_cancelled(job)){
+            line[0] = '\0';
+        } else if(str != NULL){
+            if(reverse){
+                chain[0] = '\0';
+                rc = RESOLVE_FAILURE;
+                if(reverse_name(str, revname, MAX_REVERSE_LENGTH) == 0)
+                    rc = ptr_lookup(job->errfp, &res, args->caches, revname,
+                            chain, MAX_CHAIN_LENGTH, host, MAX_NAME_LENGTH);
+                /* Addresses only in /etc/hosts are not in the DNS */
+                if(rc == RESOLVE_NOT_FOUND)
+                    rc = hosts_name_lookup(job->errfp, str, host,
+                            MAX_NAME_LENGTH);
+                if(rc == RESOLVE_FAILURE)
+                    host[0] = '\0';
+                format_result(line, MAX_RESULT_LENGTH, follow_cname,
+                        str, host, chain);
+            } else {
+                if(follow_cname){
+                    rc = cname_lookup(job->errfp, &res, args->caches, str,
+                            chain, MAX_CHAIN_LENGTH, ip_str, MAX_IP_LENGTH);
+                    /* Only ask the system resolver about names the
+                     * DNS cannot answer: single labels, which it
+                     * completes with the search domains, and names
+                     * in /etc/hosts. Anything else would just get
+                     * the same NXDOMAIN again. */
+                    if(rc == RESOLVE_NOT_FOUND){
+                        if(strchr(str, '.') == NULL || hosts_has_name(str))
+                            rc = fdnslookup(job->errfp, str, ip_str,
+                                    MAX_IP_LENGTH) == UTIL_SUCCESS
+                                ? RESOLVE_SUCCESS : RESOLVE_FAILURE;
+                        else {
+                            fprintf(job->errfp, "Error looking up \"%s\": "
+                                    "Name or service not known\n", str);
+                            rc = RESOLVE_FAILURE;
+                        }
+                    }
+                } else
+                    rc = fdnslookup(job->errfp, str, ip_str, MAX_IP_LENGTH)
+                        == UTIL_SUCCESS ? RESOLVE_SUCCESS : RESOLVE_FAILURE;
+                if(rc != RESOLVE_SUCCESS){
+                    /* Both lookups print an error, so no need to print
+                     * one here.
+                     * Empty ip_str because it probably contains junk */
+                    ip_str[0] = '\0';
+                }
+                format_result(line, MAX_RESULT_LENGTH, follow_cname,
+                        str, ip_str, chain);
+            }
         }
         /* Write the URL and IP to the file */
-        rc = pthread_mutex_lock(outmutex);
-        if(rc != 0){
-            fprintf(stderr, "There was an error locking the mutex.\n");
-            return NULL;
-        }
-        fprintf(outputfp, "%s, %s\n", str, ip_str);
-        rc = pthread_mutex_unlock(outmutex);
-        if(rc != 0){
-            fprintf(stderr, "There was an error unlocking the mutex.\n");
+        rc = submit_result(job, item, str != NULL ? line : NULL);
+        if(rc != 0)
             return NULL;
-        }
-        /* Remove the string from the heap */
-        free(str);
     }
 
+    if(args->caches != NULL)
+        res_nclose(&res);
+
     return NULL;
 }
 
 int main(int argc, char *argv[]){
 
     /* File vars */
-    int inputfc = argc - 2;     // Number of input files.
-    FILE *outputfp;             // Pointer to the output file.
-    FILE *inputfps[inputfc];
+    int inputfc = 0;            // Number of input files.
+    FILE *outputfp = NULL;      // Pointer to the output file.
+    FILE *inputfps[argc];       // argc bounds the number of input files.
+    char *inputnames[argc];
+    struct stat outstat;
     /* Threads vars */
-    pthread_t rthreads[inputfc];
     pthread_t *wthreads;
-    struct reader_args rargs[inputfc]; // Array of arguments for reader threads
     struct consumer_args cargs;
+    struct job job;
+    /* Option vars */
+    int follow_cname = 0;
+    struct resolver_caches caches;
+    char *ckpt_path = NULL;
+    int resume = 0;
+    int resumed = 0;
+    struct checkpoint ckpt;
+    int order = ORDER_NONE;
+    long window = REORDER_WINDOW;
+    struct reorder ro;
+    int idn = 0;
+    int reverse = 0;
+    int job_opts = 0;           // Whether any per-job option was given.
+    char *daemon_path = NULL;
+    char *client_path = NULL;
+    struct daemon_request req;
+    char *end;
+    static struct option long_opts[] = {
+        {"cname", no_argument, NULL, 'c'},
+        {"checkpoint", required_argument, NULL, 'k'},
+        {"resume", no_argument, NULL, 'R'},
+        {"order", required_argument, NULL, 'o'},
+        {"window", required_argument, NULL, 'w'},
+        {"idn", no_argument, NULL, 'I'},
+        {"reverse", no_argument, NULL, 'r'},
+        {"daemon", required_argument, NULL, 'D'},
+        {"client", required_argument, NULL, 'C'},
+        {NULL, 0, NULL, 0}
+    };
     /* Queue vars */
     queue url_q;
     pthread_mutex_t qmutex;
     /* Reader args */
     int reader_stat;
     pthread_mutex_t status_mutex;
+    pthread_cond_t status_cond;
     /* Consumer vars */
-    pthread_mutex_t outmutex;
     int core_count;
     /* Misc vars */
     pthread_mutex_t randmutex;
+    int status;                 // The job's status, 0 on success.
     int i, j, rc;
 
+    /* Parse the options */
+    while((rc = getopt_long(argc, argv, "ck:o:w:r", long_opts, NULL)) != -1){
+        if(rc != 'D' && rc != 'C')
+            job_opts = 1;
+        switch(rc){
+            case 'c':
+                follow_cname = 1;
+                break;
+            case 'k':
+                ckpt_path = optarg;
+                break;
+            case 'R':
+                resume = 1;
+                break;
+            case 'o':
+                if(strcmp(optarg, "input") == 0)
+                    order = ORDER_INPUT;
+                else if(strcmp(optarg, "file") == 0)
+                    order = ORDER_FILE;
+                else {
+                    fprintf(stderr, "Unknown order: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'I':
+                idn = 1;
+                break;
+            case 'r':
+                reverse = 1;
+                break;
+            case 'w':
+                window = strtol(optarg, &end, 10);
+                if(*optarg == '\0' || *end != '\0' || window < 2){
+                    fprintf(stderr, "The window must be a number of at "
+                            "least 2: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'D':
+                daemon_path = optarg;
+                break;
+            case 'C':
+                client_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage:\n %s %s\n %s %s\n",
+                        argv[0], USAGE, argv[0], DAEMON_USAGE);
+                return EXIT_FAILURE;
+        }
+    }
+
     /* Check the args */
-    if(argc < MINARGS){
-        fprintf(stderr, "Not enough arguments: %d\n", (argc - 1));
+    if(daemon_path != NULL){
+        if(argc - optind != 0 || client_path != NULL || job_opts){
+            fprintf(stderr, "The daemon takes no files or options. Pass "
+                    "them with --client.\n");
+            fprintf(stderr, "Usage:\n %s %s\n", argv[0], DAEMON_USAGE);
+            return EXIT_FAILURE;
+        }
+    } else if(argc - optind < MINARGS){
+        fprintf(stderr, "Not enough arguments: %d\n", (argc - optind));
+        fprintf(stderr, "Usage:\n %s %s\n %s %s\n",
+                argv[0], USAGE, argv[0], DAEMON_USAGE);
+        return EXIT_FAILURE;
+    }
+    if(reverse && idn){
+        fprintf(stderr, "-r and --idn cannot be used together.\n");
+        fprintf(stderr, "Usage:\n %s %s\n", argv[0], USAGE);
+        return EXIT_FAILURE;
+    }
+    if(resume && ckpt_path == NULL){
+        fprintf(stderr, "--resume requires a checkpoint file.\n");
         fprintf(stderr, "Usage:\n %s %s\n", argv[0], USAGE);
         return EXIT_FAILURE;
     }
+    if(client_path != NULL && ckpt_path != NULL){
+        fprintf(stderr, "Checkpoints are not supported with --client.\n");
+        return EXIT_FAILURE;
+    }
 
-    /* Open the input files */
-    j = 0; //argv index.
-    for(i=0; i<inputfc; i++){
-        inputfps[i] = fopen(argv[j+1], "r");
-        j++;
-        if(inputfps[i] == NULL) {
-            fprintf(stderr, "Error opening input file: %s\n", argv[j]);
-            perror("");
-            /* Reduce the file count, and decrement i so the next
-             * iteration will store to the same index */
-            inputfc--;
-            i--;
-            continue;
+    if(daemon_path == NULL){
+        /* Open the input files. Every argument but the last is one. */
+        for(j = optind; j < argc - 1; j++){
+            inputfps[inputfc] = fopen(argv[j], "r");
+            if(inputfps[inputfc] == NULL) {
+                fprintf(stderr, "Error opening input file: %s\n", argv[j]);
+                perror("");
+                continue;
+            }
+            inputnames[inputfc] = argv[j];
+            inputfc++;
+        }
+
+        /* Check that there are input files */
+        if(inputfc < 1){
+            fprintf(stderr, "No valid input files. Terminating.\n");
+            return EXIT_FAILURE;
+        }
+
+        /* Open the output file. A resumed run keeps the output
+         * of the previous run, so it must not be truncated yet. */
+        if(resume)
+            outputfp = fopen(argv[argc-1], "r+");
+        if(!outputfp)
+            outputfp = fopen(argv[argc-1], "w");
+        if(!outputfp){
+            perror("Error opening ouput file");
+            return EXIT_FAILURE;
         }
     }
 
-    /* Check that there are input files */
-    if(inputfc < 1){
-        fprintf(stderr, "No valid input files. Terminating.\n");
-        return EXIT_FAILURE;
+    /* The daemon may get --idn jobs. It starts without a UTF-8
+     * locale too, and refuses those jobs instead. The client
+     * leaves names to the daemon. */
+    if(client_path == NULL
+            && normalize_init(idn || daemon_path != NULL) != 0){
+        if(daemon_path == NULL){
+            fprintf(stderr, "--idn needs a UTF-8 locale to case fold names.\n");
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "No UTF-8 locale to case fold names, so --idn "
+                "jobs will be refused.\n");
     }
 
-    /* Open the output file */
-    outputfp = fopen(argv[argc-1], "w");
-    if(!outputfp){
-        perror("Error opening ouput file");
-        return EXIT_FAILURE;
+    /* Hand the files to the daemon and wait for it to finish */
+    if(client_path != NULL){
+        req.follow_cname = follow_cname;
+        req.reverse = reverse;
+        req.idn = idn;
+        req.order = order;
+        req.window = window;
+        req.nfiles = inputfc;
+        rc = client_run(client_path, &req, inputfps, outputfp);
+        for(i = 0; i < inputfc; i++)
+            fclose(inputfps[i]);
+        fclose(outputfp);
+        return rc == DAEMON_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* Load the checkpoint, then drop any output written after it */
+    if(ckpt_path != NULL){
+        rc = checkpoint_init(&ckpt, inputfc);
+        if(rc == CHECKPOINT_FAILURE)
+            return EXIT_FAILURE;
+        if(resume){
+            if(fstat(fileno(outputfp), &outstat) != 0){
+                perror("Error reading the output file");
+                return EXIT_FAILURE;
+            }
+            rc = checkpoint_load(&ckpt, ckpt_path, inputnames,
+                    (long)outstat.st_size);
+            if(rc == CHECKPOINT_FAILURE)
+                return EXIT_FAILURE;
+            resumed = (rc == CHECKPOINT_SUCCESS);
+        }
+        if(ftruncate(fileno(outputfp), ckpt.out_pos) != 0
+                || fseek(outputfp, 0, SEEK_END) != 0){
+            perror("Error truncating the output file");
+            return EXIT_FAILURE;
+        }
+        rc = checkpoint_open(&ckpt, ckpt_path, inputnames, resumed, outputfp);
+        if(rc == CHECKPOINT_FAILURE)
+            return EXIT_FAILURE;
     }
 
     /* Init the url queue */
@@ -302,27 +918,40 @@ int main(int argc, char *argv[]){
         return EXIT_FAILURE;
     }
 
-    /* Spawn reader threads */
-    /* Init reader vars */
-    reader_stat = PROCESSING;
+    /* Init the caches shared by the resolver threads. The daemon
+     * does not know which jobs it will get, so it always does. */
+    if(follow_cname || reverse || daemon_path != NULL){
+        rc = resolver_caches_init(&caches);
+        if(rc == RESOLVE_FAILURE){
+            fprintf(stderr, "Error initializing the caches.\n");
+            return EXIT_FAILURE;
+        }
+        cargs.caches = &caches;
+    } else {
+        cargs.caches = NULL;
+    }
+
+    /* Init the shared mutexes */
     rc = pthread_mutex_init(&qmutex, NULL);
     rc = pthread_mutex_init(&randmutex, NULL) || rc;
+    rc = pthread_mutex_init(&status_mutex, NULL) || rc;
     if(rc != 0){
         fprintf(stderr, "There was an error initializing the mutex.\n");
         return EXIT_FAILURE;
     }
-    for(i = 0; i < inputfc; i++) {
-        /* Init reader arg struct */
-        rargs[i].inputfp = inputfps[i];
-        rargs[i].url_q = &url_q;
-        rargs[i].qmutex = &qmutex;
-        rargs[i].randmutex = &randmutex;
-        rc = pthread_create(rthreads + i, NULL, reader, rargs + i);
-        if(rc){
-            fprintf(stderr, "ERROR: Return code from pthread_create() is %d\n", rc);
-            return EXIT_FAILURE;
-        }
+    rc = pthread_cond_init(&status_cond, NULL);
+    if(rc != 0){
+        fprintf(stderr, "There was an error initializing the condition.\n");
+        return EXIT_FAILURE;
     }
+    /* Init writer args */
+    reader_stat = daemon_path != NULL ? IDLE : PROCESSING;
+    cargs.url_q = &url_q;
+    cargs.reader_stat = &reader_stat;
+    cargs.qmutex = &qmutex;
+    cargs.status_mutex = &status_mutex;
+    cargs.status_cond = &status_cond;
+    cargs.randmutex = &randmutex;
 
     /* Spawn writer threads */
     /* Get the number of cores */
@@ -334,23 +963,7 @@ int main(int argc, char *argv[]){
         fprintf(stderr, "Error mallocing.\n");
         return EXIT_FAILURE;
     }
-    /* Init writer mutexes */
-    rc = pthread_mutex_init(&outmutex, NULL);
-    rc = pthread_mutex_init(&status_mutex, NULL) || rc;
-    if(rc != 0){
-        fprintf(stderr, "There was an error initializing the mutex.\n");
-        return EXIT_FAILURE;
-    }
-    /* Init writer args */
-    cargs.outputfp = outputfp;
-    cargs.url_q = &url_q;
-    cargs.reader_stat = &reader_stat;
-    cargs.qmutex = &qmutex;
-    cargs.status_mutex = &status_mutex;
-    cargs.outmutex = &outmutex;
-    cargs.randmutex = &randmutex;
     for(i = 0; i < core_count; i++) {
-        /* Init consumer args struct */
         rc = pthread_create(wthreads + i, NULL, writer, &cargs);
         if(rc){
             fprintf(stderr, "ERROR: Return code from pthread_create() is %d\n", rc);
@@ -358,22 +971,40 @@ int main(int argc, char *argv[]){
         }
     }
 
-    /* Join the reader threads before closing the files. */
-    for(i = 0; i < inputfc; i++){
-        rc = pthread_join(rthreads[i], NULL);
-        if(rc != 0){
-            fprintf(stderr, "There was an error joining the threads.\n");
+    /* Serve jobs until something goes wrong */
+    if(daemon_path != NULL){
+        daemon_run(daemon_path, &cargs);
+        return EXIT_FAILURE;
+    }
+
+    /* Init the job */
+    rc = job_init(&job, outputfp);
+    if(rc != 0)
+        return EXIT_FAILURE;
+    job.follow_cname = follow_cname;
+    job.reverse = reverse;
+    job.idn = idn;
+    job.ckpt = ckpt_path != NULL ? &ckpt : NULL;
+    job.resumed = resumed;
+    if(order != ORDER_NONE){
+        rc = reorder_init(&ro, order, inputfc, window);
+        if(rc == REORDER_FAILURE)
             return EXIT_FAILURE;
-        }
+        job.reorder = &ro;
     }
-    /* The readers are finished. */
+
+    /* Run the job. It returns once every result is written. */
+    status = run_job(&cargs, &job, inputfps, inputfc);
+
+    /* Let the writers exit */
     rc = pthread_mutex_lock(&status_mutex);
     if(rc != 0){
         fprintf(stderr, "There was an error locking the mutex.\n");
         return EXIT_FAILURE;
     }
     reader_stat = FINISHED;
-    rc = pthread_mutex_unlock(&status_mutex);
+    rc = pthread_cond_broadcast(&status_cond);
+    rc = pthread_mutex_unlock(&status_mutex) || rc;
     if(rc != 0){
         fprintf(stderr, "There was an error unlocking the mutex.\n");
         return EXIT_FAILURE;
@@ -381,14 +1012,14 @@ int main(int argc, char *argv[]){
 
     /* Close the input files */
     for(i=0; i<inputfc; i++){
-        rc = fclose(rargs[i].inputfp);
+        rc = fclose(inputfps[i]);
         if(rc != 0){
             fprintf(stderr, "There was an error closing an input file. ");
             perror("");
         }
     }
 
-    /* Join the reader threads before closing the files. */
+    /* Join the writer threads before closing the output. */
     for(i = 0; i < core_count; i++){
         rc = pthread_join(wthreads[i], NULL);
         if(rc != 0){
@@ -397,12 +1028,26 @@ int main(int argc, char *argv[]){
         }
     }
 
+    if(order != ORDER_NONE)
+        reorder_cleanup(&ro);
+
+    /* Record the final progress before closing the output */
+    if(ckpt_path != NULL){
+        rc = checkpoint_close(&ckpt);
+        if(rc == CHECKPOINT_FAILURE){
+            fprintf(stderr, "There was an error writing a checkpoint.\n");
+            status = 1;
+        }
+    }
+
     /* Close the ouput file */
     rc = fclose(outputfp);
     if(rc != 0){
         fprintf(stderr, "There was an error closing the output file. ");
         perror("");
+        status = 1;
     }
+    job_cleanup(&job);
 
     /* Free wthreads */
     free(wthreads);
@@ -410,5 +1055,9 @@ int main(int argc, char *argv[]){
     /* Cleanup queue */
     queue_cleanup(&url_q);
 
-    pthread_exit(NULL);
+    /* Cleanup caches */
+    if(cargs.caches != NULL)
+        resolver_caches_cleanup(&caches);
+
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
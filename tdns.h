@@ -5,27 +5,67 @@
 #define MAX_NAME_LENGTH 1025
 #define MIN_RESOLVER_THREADS 2
 
-#define MINARGS 3
-#define USAGE "INPUT_FILE [INPUT_FILE ...] OUTPUT_FILE"
+#define MINARGS 2
+#define MAX_RESULT_LENGTH (MAX_NAME_LENGTH + MAX_IP_LENGTH + MAX_CHAIN_LENGTH + 8)
+
+#define USAGE "[-c] [-r | --idn] [-k CHECKPOINT_FILE [--resume]] " \
+    "[-o input|file [-w WINDOW]] [--client SOCKET] " \
+    "INPUT_FILE [INPUT_FILE ...] OUTPUT_FILE"
+#define DAEMON_USAGE "--daemon SOCKET"
 #define Q_SIZE 5
 #define PROCESSING 1
 #define FINISHED 0
+#define IDLE 2                  // No jobs, so the writers wait.
+
+/* A name on the queue, along with the span of the input
+ * file it was read from. Blank lines before the name are
+ * part of its span. In reverse mode the name is an address.
+ * An item with no name marks the end of a file when results
+ * are reordered. */
+struct url_item {
+    char *name;
+    struct job *job;            // The job the name belongs to.
+    int file;
+    struct span span;
+    long seq;                   // Position within the file when reordering.
+    char *result;               // The output line while it waits to be written.
+};
+
+/* One run over a set of input files into one output. The
+ * CLI runs a single job. The daemon runs one per client, and
+ * the jobs share the queue, the writers and the caches. */
+struct job {
+    FILE *outputfp;
+    FILE *errfp;                // Where rejections and lookup errors go.
+    pthread_mutex_t outmutex;
+    int follow_cname;
+    int reverse;                // Look up PTR records of addresses.
+    int idn;                    // Convert IDNs instead of rejecting them.
+    struct checkpoint *ckpt;    // NULL if checkpoints are off.
+    int resumed;                // Whether ckpt holds a previous run.
+    struct reorder *reorder;    // NULL if results are not reordered.
+    long pending;               // Items not yet submitted. Guarded by outmutex.
+    int cancelled;              // No one wants the results. Guarded by outmutex.
+};
 
 struct reader_args {
     FILE *inputfp;
     queue *url_q;
     pthread_mutex_t *qmutex;
     pthread_mutex_t *randmutex;
+    int file;                   // Index of the input file.
+    struct file_progress resume; // Work done by a previous run.
+    struct job *job;
 };
 
 struct consumer_args {
-    FILE *outputfp;
     queue *url_q;
     int *reader_stat;
     pthread_mutex_t *qmutex;
     pthread_mutex_t *status_mutex;
-    pthread_mutex_t *outmutex;
+    pthread_cond_t *status_cond;    // Signalled when reader_stat changes.
     pthread_mutex_t *randmutex;
+    struct resolver_caches *caches; // NULL if the resolver is not used.
 };
 
 /* Desc:    A thread safe sleep function that will sleep
@@ -39,22 +79,24 @@ int rsleep(pthread_mutex_t *randmutex);
 
 /* Desc:    A thread safe wrapper for pushing to the queue.
  *          The queue is globally defined with name url_q.
- * Args:    item: a string ending with \0
+ * Args:    item: a heap allocated url_item.
  * Return:  0 on success. 1 on failure.
  */
 int ts_queue_push(queue* url_q, pthread_mutex_t *qmutex,
-        pthread_mutex_t *randmutex, char item[]);
+        pthread_mutex_t *randmutex, struct url_item *item);
 
 /* Desc:    A thread safe wrapper for popping from the queue.
  *          The queue is globally defined with name url_q.
+ *          While the queue is empty it polls, or if reader_stat
+ *          is IDLE, waits on status_cond for it to change.
  * Return:  A pointer to the popped item. NULL is returned
  *          if either:
  *          1) The call has failed.
  *          2) The queue is empty and the readers are done.
  */
-char *ts_queue_pop(queue *url_q, pthread_mutex_t *qmutex,
+struct url_item *ts_queue_pop(queue *url_q, pthread_mutex_t *qmutex,
         pthread_mutex_t *randmutex,
-        pthread_mutex_t *status_mutex,
+        pthread_mutex_t *status_mutex, pthread_cond_t *status_cond,
         int *reader_stat);
 
 /* Desc: Removes the first newline character in the string
@@ -64,6 +106,58 @@ char *ts_queue_pop(queue *url_q, pthread_mutex_t *qmutex,
  */
 int removenl(int max_len, char *str);
 
+/* Desc:    Strips leading and trailing whitespace in place.
+ * Args:    str: the string, ending with \0.
+ * Return:  A pointer to the first character kept.
+ */
+char *trim(char *str);
+
+/* Desc:    Initializes a job writing to outputfp, with every
+ *          option off and errors going to stderr.
+ * Return:  0 on success. 1 on failure.
+ */
+int job_init(struct job *job, FILE *outputfp);
+
+/* Desc:    Frees a job's mutex. */
+void job_cleanup(struct job *job);
+
+/* Desc:    Adds n to the count of the job's pending items.
+ * Return:  0 on success. 1 on failure.
+ */
+int job_pending_add(struct job *job, long n);
+
+/* Desc:    Cancels a job. Its readers stop at the next name, and
+ *          the names already queued are drained without being
+ *          looked up or written.
+ */
+void job_cancel(struct job *job);
+
+/* Desc:    Returns 1 if the job was cancelled, 0 otherwise. */
+int job_cancelled(struct job *job);
+
+/* Desc:    Runs a job. A reader thread is started for each input
+ *          file and the names are looked up by writer threads
+ *          that must already be running. Returns once every
+ *          result has been written, leaving the files open.
+ * Args:    cargs: the args the writers were started with.
+ *          job: the job, set up by the caller.
+ *          inputfps: the input files, inputfc of them.
+ * Return:  0 on success. 1 on failure.
+ */
+int run_job(struct consumer_args *cargs, struct job *job,
+        FILE **inputfps, int inputfc);
+
+/* Desc:    Queues one name read by a reader, or writes it
+ *          straight to the output if it was rejected.
+ * Args:    args: the reader's args.
+ *          name: the name, ending with \0.
+ *          span: the span of the input file it covers.
+ *          reason: why the name was rejected, or NULL.
+ * Return:  0 on success. 1 on failure.
+ */
+int queue_name(struct reader_args *args, const char *name,
+        const struct span *span, const char *reason);
+
 /* Desc:    The reader/producer thread function.
  *          Reads from a file and writes to a queue.
  * Args:    Pointer to reader_args.
@@ -71,6 +165,49 @@ int removenl(int max_len, char *str);
  */
 void *reader(void *arg);
 
+/* Desc:    Frees a url_item and its strings.
+ * Args:    item: pointer to the item.
+ */
+void free_item(struct url_item *item);
+
+/* Desc:    Writes a result line to the output file and records
+ *          it in the checkpoint. The output mutex must be held.
+ * Args:    job: the job holding the output.
+ *          item: the item the result belongs to.
+ *          line: the line to write, ending with a newline.
+ * Return:  0 on success. 1 on failure.
+ */
+int write_result(struct job *job, struct url_item *item,
+        const char *line);
+
+/* Desc:    Formats a result line.
+ * Args:    line: buffer of size size.
+ *          follow_cname: if set, chain is written as a third column.
+ */
+void format_result(char *line, int size, int follow_cname,
+        const char *name, const char *ip, const char *chain);
+
+/* Desc:    Writes a finished item's result line, either directly
+ *          or through the reorder buffer, and frees the item
+ *          once it is written. Takes the output mutex and counts
+ *          the item off the job's pending items. Nothing is
+ *          written for a cancelled job.
+ * Args:    job: the job holding the output.
+ *          item: the finished item.
+ *          line: the result line, or NULL for an end of file
+ *          marker.
+ * Return:  0 on success. 1 on failure.
+ */
+int submit_result(struct job *job, struct url_item *item,
+        const char *line);
+
+/* Desc:    Writes every result the reorder buffer is ready to
+ *          release. The output mutex must be held.
+ * Args:    job: the job holding the output.
+ * Return:  0 on success. 1 on failure.
+ */
+int write_ready(struct job *job);
+
 /* Desc:    The writer/consumer thread function.
  *          Reads from the queue and writes IPs
  *          to a file.
@@ -13,6 +13,11 @@
 #include "util.h"
 
 int dnslookup(const char* hostname, char* firstIPstr, int maxSize){
+    return fdnslookup(stderr, hostname, firstIPstr, maxSize);
+}
+
+int fdnslookup(FILE* errfp, const char* hostname,
+	       char* firstIPstr, int maxSize){
 
     /* Local vars */
     struct addrinfo* headresult = NULL;
@@ -31,7 +36,7 @@ int dnslookup(const char* hostname, char* firstIPstr, int maxSize){
     /* Lookup Hostname */
     addrError = getaddrinfo(hostname, NULL, NULL, &headresult);
     if(addrError){
-	fprintf(stderr, "Error looking up \"%s\": %s\n",
+	fprintf(errfp, "Error looking up \"%s\": %s\n",
 		hostname, gai_strerror(addrError));
 	return UTIL_FAILURE;
     }
@@ -44,7 +49,8 @@ int dnslookup(const char* hostname, char* firstIPstr, int maxSize){
 	    ipv4addr = &(ipv4sock->sin_addr);
 	    if(!inet_ntop(result->ai_family, ipv4addr,
 			  ipv4str, sizeof(ipv4str))){
-		perror("Error Converting IP to String");
+		fprintf(errfp, "Error Converting IP to String: %s\n",
+			strerror(errno));
 		return UTIL_FAILURE;
 	    }
 #ifdef UTIL_DEBUG
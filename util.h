@@ -37,4 +37,10 @@ int dnslookup(const char* hostname,
 	      char* firstIPstr,
 	      int maxSize);
 
+/* As dnslookup, but errors are printed to errfp */
+int fdnslookup(FILE* errfp,
+	       const char* hostname,
+	       char* firstIPstr,
+	       int maxSize);
+
 #endif